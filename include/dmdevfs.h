@@ -7,6 +7,10 @@
 #ifndef DMDEVFS_H
 #define DMDEVFS_H
 
+#include "dmod.h"
+#include "dmfsi.h"
+#include "dmdevfs_defs.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,6 +19,520 @@ extern "C" {
 #define DMDEVFS_VERSION_MAJOR 0
 #define DMDEVFS_VERSION_MINOR 1
 
+// ============================================================================
+//                      Driver extension commands
+// ============================================================================
+//
+// Optional features are requested from drivers through dmdrvi_ioctl with the
+// commands below. A driver that does not recognize a command must return a
+// non-zero value, and dmdevfs then falls back to a generic implementation.
+//
+
+/**
+ * @brief Base of the ioctl commands reserved for dmdevfs
+ */
+#define DMDEVFS_IOCTL_BASE          0x44560000  // 'DV'
+
+/**
+ * @brief Check if a command is in the range reserved for dmdevfs
+ */
+#define DMDEVFS_IOCTL_IS_RESERVED(command)  (((unsigned)(command) & 0xFFFF0000u) == DMDEVFS_IOCTL_BASE)
+
+/**
+ * @brief Map the device into the CPU address space (arg: dmdevfs_map_t*)
+ */
+#define DMDEVFS_IOCTL_MAP           (DMDEVFS_IOCTL_BASE + 0x01)
+
+/**
+ * @brief Release a mapping returned by DMDEVFS_IOCTL_MAP (arg: dmdevfs_map_t*)
+ */
+#define DMDEVFS_IOCTL_UNMAP         (DMDEVFS_IOCTL_BASE + 0x02)
+
+/**
+ * @brief Window of a device in the CPU address space
+ */
+typedef struct
+{
+    void* address;              // Address of the window
+    size_t length;              // Length of the window in bytes
+} dmdevfs_map_t;
+
+/**
+ * @brief Wait until the device is ready (arg: dmdevfs_poll_t*)
+ */
+#define DMDEVFS_IOCTL_POLL          (DMDEVFS_IOCTL_BASE + 0x03)
+
+/**
+ * @brief Readiness events reported by dmdevfs_poll
+ */
+#define DMDEVFS_POLL_IN             0x01    // Data can be read without blocking
+#define DMDEVFS_POLL_OUT            0x02    // Data can be written without blocking
+#define DMDEVFS_POLL_ERR            0x04    // Error or hang-up of the device
+
+/**
+ * @brief Readiness query of a device
+ */
+typedef struct
+{
+    int events;                 // DMDEVFS_POLL_* events to wait for
+    int timeout_ms;             // Maximum time to wait (0 - do not wait, negative - forever)
+    int revents;                // Ready events, set by the driver
+} dmdevfs_poll_t;
+
+/**
+ * @brief Apply a list of commands in one call (arg: dmdevfs_ioctl_batch_t*)
+ *
+ * The driver applies the commands in order, stores the result of each one and
+ * sets `applied` to the number of commands it processed. A driver that does
+ * not support batches must leave `applied` unchanged.
+ */
+#define DMDEVFS_IOCTL_BATCH         (DMDEVFS_IOCTL_BASE + 0x04)
+
+/**
+ * @brief Device control command
+ */
+typedef struct
+{
+    int command;                // Driver-specific command
+    void* arg;                  // Argument of the command
+    int result;                 // Value returned for the command (0 - success)
+} dmdevfs_ioctl_cmd_t;
+
+/**
+ * @brief List of device control commands
+ */
+typedef struct
+{
+    dmdevfs_ioctl_cmd_t* commands;  // Commands to apply
+    size_t count;                   // Number of commands
+    size_t applied;                 // Number of processed commands, set by the driver
+} dmdevfs_ioctl_batch_t;
+
+/**
+ * @brief Move the position of an open device (arg: dmdevfs_seek_t*)
+ *
+ * Supported by drivers of devices with a position (e.g. EEPROMs). The driver
+ * sets `position` to the new position from the start of the device.
+ */
+#define DMDEVFS_IOCTL_SEEK          (DMDEVFS_IOCTL_BASE + 0x05)
+
+/**
+ * @brief Seek request
+ */
+typedef struct
+{
+    long offset;                // Offset relative to `whence`
+    int whence;                 // DMFSI_SEEK_SET, DMFSI_SEEK_CUR or DMFSI_SEEK_END
+    long position;              // New position, set by the driver
+} dmdevfs_seek_t;
+
+/**
+ * @brief Describe the I/O capabilities of the device (arg: dmdevfs_caps_t*)
+ *
+ * The descriptor is prefilled by dmdevfs; the driver overwrites the fields it
+ * knows. Options in the configuration file take precedence over the driver.
+ */
+#define DMDEVFS_IOCTL_GET_CAPS      (DMDEVFS_IOCTL_BASE + 0x06)
+
+/**
+ * @brief Capability flags of a device
+ */
+#define DMDEVFS_CAP_SEEKABLE        0x01    // The position can be set with _lseek
+#define DMDEVFS_CAP_STREAM          0x02    // Reads consume the data (UART, sensor, ...)
+#define DMDEVFS_CAP_FIXED_SIZE      0x04    // The device has a fixed size reported by _stat
+
+/**
+ * @brief I/O capabilities of a device
+ */
+typedef struct
+{
+    uint32_t flags;             // DMDEVFS_CAP_* flags
+    size_t preferred_size;      // Transfer size with the best throughput (0 - unknown)
+    size_t max_size;            // Largest transfer accepted in one call (0 - no limit)
+    size_t alignment;           // Alignment of offsets and sizes of transfers (1 - any)
+    size_t buffer_alignment;    // Alignment of buffers given to the driver
+    size_t erase_size;          // Size of an erase block (0 - no erase needed)
+    uint32_t queue_depth;       // Requests the hardware can keep in flight
+} dmdevfs_caps_t;
+
+/**
+ * @brief Describe a child node published by the device (arg: dmdevfs_child_t*)
+ *
+ * Lets one driver context serve several nodes, e.g. the channels of an ADC or
+ * the ports of a UART expander. When a node configured with `children = true`
+ * is created, dmdevfs asks for `index` 0, 1, ... until the driver returns
+ * non-zero or leaves `name` empty, and publishes each `name` as the node
+ * `<path of the node>/<name>`. The node itself is then only the directory of
+ * its children.
+ */
+#define DMDEVFS_IOCTL_GET_CHILD     (DMDEVFS_IOCTL_BASE + 0x07)
+
+/**
+ * @brief Bind a device just opened to a child node (arg: dmdevfs_child_t*)
+ *
+ * Sent right after dmdrvi_open for every open of a child node, because
+ * dmdrvi_open does not take a path. The open fails if the driver returns
+ * non-zero. dmdrvi_stat of a child node receives the name of the child.
+ */
+#define DMDEVFS_IOCTL_OPEN_CHILD    (DMDEVFS_IOCTL_BASE + 0x08)
+
+/**
+ * @brief Maximum length of the name of a child node (with the terminator)
+ */
+#define DMDEVFS_CHILD_NAME_LENGTH   16
+
+/**
+ * @brief Child node of a device
+ */
+typedef struct
+{
+    uint32_t index;                         // Index of the child, set by dmdevfs
+    char name[DMDEVFS_CHILD_NAME_LENGTH];   // Name of the child (one path segment)
+} dmdevfs_child_t;
+
+/**
+ * @brief Write modes of an open file
+ */
+#define DMDEVFS_WRITE_DIRECT        0   // All written data goes to the driver
+#define DMDEVFS_WRITE_DIFFERENTIAL  1   // Blocks equal to the contents of the device are skipped
+
+/**
+ * @brief Access pattern hints for dmdevfs_advise()
+ */
+#define DMDEVFS_ADVICE_NORMAL       0   // No particular pattern (the `readahead` of the node)
+#define DMDEVFS_ADVICE_SEQUENTIAL   1   // Data is read in order, read ahead more
+#define DMDEVFS_ADVICE_RANDOM       2   // Data is read at random positions, do not read ahead
+#define DMDEVFS_ADVICE_WILLNEED     3   // A range is going to be read soon
+#define DMDEVFS_ADVICE_DONTNEED     4   // A range is not going to be read again soon
+#define DMDEVFS_ADVICE_NOREUSE      5   // Data is read only once
+
+// ============================================================================
+//                      Compressed images
+// ============================================================================
+
+/**
+ * @brief Magic number at the start of a compressed image ("DMZ4")
+ */
+#define DMDEVFS_IMAGE_MAGIC         0x345A4D44u
+
+/**
+ * @brief Header of a compressed image (all fields little-endian)
+ *
+ * The header is followed by `block_count + 1` 32-bit offsets from the start of
+ * the device: block i is stored between offsets i and i + 1. Every block
+ * decodes to `block_size` bytes, the last one to the rest of the image. A
+ * block stored in its decoded size is not compressed, other blocks are LZ4
+ * blocks.
+ */
+typedef struct
+{
+    uint32_t magic;             // DMDEVFS_IMAGE_MAGIC
+    uint32_t block_size;        // Decoded size of a block
+    uint32_t image_size;        // Decoded size of the image
+    uint32_t block_count;       // Number of blocks
+} dmdevfs_image_header_t;
+
+// ============================================================================
+//                      Statistics
+// ============================================================================
+
+/**
+ * @brief Driver calls watched for slow calls
+ */
+#define DMDEVFS_OP_NONE             0   // No call
+#define DMDEVFS_OP_STAT             1   // dmdrvi_stat
+#define DMDEVFS_OP_OPEN             2   // dmdrvi_open
+#define DMDEVFS_OP_CLOSE            3   // dmdrvi_close
+#define DMDEVFS_OP_READ             4   // dmdrvi_read
+#define DMDEVFS_OP_WRITE            5   // dmdrvi_write
+#define DMDEVFS_OP_FLUSH            6   // dmdrvi_flush
+#define DMDEVFS_OP_IOCTL            7   // dmdrvi_ioctl
+
+/**
+ * @brief Statistics of a device
+ */
+typedef struct
+{
+    uint32_t slow_call_ms;      // Duration of a slow driver call (0 - calls are not watched)
+    uint32_t slow_calls;        // Driver calls that took at least `slow_call_ms`
+    int last_slow_op;           // DMDEVFS_OP_* of the last slow call
+    uint32_t last_slow_ms;      // Duration of the last slow call (so far, if in progress)
+    uint32_t max_call_ms;       // Longest driver call
+    uint32_t in_flight;         // Driver calls in progress
+    int in_flight_op;           // DMDEVFS_OP_* of the oldest call in progress
+    uint32_t in_flight_ms;      // Time the oldest call in progress has been running
+} dmdevfs_stats_t;
+
+/**
+ * @brief I/O of the files of a device with one tag
+ */
+typedef struct
+{
+    char tag[DMOD_MAX_MODULE_NAME_LENGTH];  // Tag of the files ("" - files without a tag)
+    uint32_t files;             // Open files with the tag
+    uint64_t reads;             // Reads of the application
+    uint64_t writes;            // Writes of the application
+    uint64_t bytes_read;        // Bytes read
+    uint64_t bytes_written;     // Bytes written
+    uint64_t read_ms;           // Time spent in reads
+    uint64_t write_ms;          // Time spent in writes
+    uint32_t max_ms;            // Longest read or write
+} dmdevfs_tag_stats_t;
+
+/**
+ * @brief Number of size classes of requests (class i - 2^i to 2^(i+1) - 1 bytes, the last one - larger)
+ */
+#define DMDEVFS_SIZE_CLASSES        16
+
+/**
+ * @brief Sampled access pattern of a device
+ */
+typedef struct
+{
+    uint32_t sample;            // Requests per recorded request
+    uint32_t sampled;           // Recorded requests
+    size_t bucket_size;         // Bytes of the device per bucket of the heatmap
+    size_t bucket_count;        // Number of buckets of the heatmap
+    uint32_t read_sizes[DMDEVFS_SIZE_CLASSES];  // Recorded reads per size class
+    uint32_t write_sizes[DMDEVFS_SIZE_CLASSES]; // Recorded writes per size class
+} dmdevfs_access_stats_t;
+
+// ============================================================================
+//                      API
+// ============================================================================
+
+/**
+ * @brief Map the device of an open file into memory
+ *
+ * Directly addressable devices (memory-mapped flash, register windows) return
+ * their window without copying. For other devices the whole device is read
+ * into a buffer owned by the file, which is then a read-only snapshot.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param address Address of the mapping
+ * @param length Length of the mapping in bytes
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _map, (dmfsi_context_t ctx, void* fp, void** address, size_t* length));
+
+/**
+ * @brief Release the mapping of an open file
+ * @note Closing the file releases the mapping as well
+ */
+dmod_dmdevfs_api(1.0, int, _unmap, (dmfsi_context_t ctx, void* fp));
+
+/**
+ * @brief Wait until an open file is ready for reading or writing
+ *
+ * Host devices are watched with epoll. Drivers are asked with
+ * DMDEVFS_IOCTL_POLL; drivers without readiness reporting are treated as
+ * always ready, as their reads and writes do not block.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param events DMDEVFS_POLL_* events to wait for
+ * @param timeout_ms Maximum time to wait (0 - do not wait, negative - forever)
+ * @return Ready DMDEVFS_POLL_* events (0 on timeout), negative error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _poll, (dmfsi_context_t ctx, void* fp, int events, int timeout_ms));
+
+/**
+ * @brief Send a device control command (baud rate, SPI mode, ...) to the driver
+ *
+ * Commands are driver-specific and forwarded to dmdrvi_ioctl (to ioctl(2) for
+ * host devices). Commands in the range reserved for dmdevfs are rejected.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param command Driver-specific command
+ * @param arg Argument of the command
+ * @param result Value returned by the driver (optional)
+ * @return DMFSI_OK if the driver returned 0, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _ioctl, (dmfsi_context_t ctx, void* fp, int command, void* arg, int* result));
+
+/**
+ * @brief Apply a list of device control commands
+ *
+ * Drivers that support DMDEVFS_IOCTL_BATCH receive the whole list in a single
+ * call, so e.g. a multi-register reconfiguration costs one bus burst. For
+ * other drivers the commands are sent one by one. Processing stops at the
+ * first command that fails; the result of each command is stored in the list.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param commands Commands to apply
+ * @param count Number of commands
+ * @param applied Number of processed commands, including a failed one (optional)
+ * @return DMFSI_OK if all commands succeeded, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _ioctl_list, (dmfsi_context_t ctx, void* fp, dmdevfs_ioctl_cmd_t* commands, size_t count, size_t* applied));
+
+/**
+ * @brief Write buffered data of the files of a mount that is due
+ *
+ * Files of nodes configured with `write_back` keep written data in a buffer, so
+ * writes do not wait for the driver. This function writes each buffer that is
+ * over its `dirty_bytes` threshold or older than `dirty_age_ms` in one driver
+ * call, and all buffers when the mount holds more than DMDEVFS_DIRTY_LIMIT
+ * bytes. The host calls it periodically, serialized with the other calls on
+ * the mount (see the Concurrency section of the README).
+ *
+ * @param ctx File system context
+ * @param next_ms Time until the next buffer becomes due (-1 if nothing is buffered, optional)
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _writeback, (dmfsi_context_t ctx, int* next_ms));
+
+/**
+ * @brief Tell dmdevfs how an open file is going to be accessed
+ *
+ * SEQUENTIAL doubles the `readahead` window of the node (DMDEVFS_READAHEAD_SIZE
+ * without one), RANDOM turns reading ahead off and NORMAL restores the window
+ * of the node. WILLNEED decodes the block of a compressed image, or reads
+ * ahead when @p offset is the position of the file. DONTNEED drops buffered
+ * data of the range. NOREUSE releases decoded blocks as soon as they are read.
+ * Streams are never read ahead, and hints that do not apply to a device are
+ * ignored.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param offset Start of the range (WILLNEED, DONTNEED)
+ * @param length Length of the range (0 - up to the end of the device)
+ * @param advice DMDEVFS_ADVICE_* hint
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _advise, (dmfsi_context_t ctx, void* fp, size_t offset, size_t length, int advice));
+
+/**
+ * @brief Get the I/O capabilities of the device of an open file
+ *
+ * The descriptor combines what dmdevfs knows about the node (size, shadow,
+ * calibration, buffer alignment), the answer of the driver to
+ * DMDEVFS_IOCTL_GET_CAPS, and the options of the configuration file. It is
+ * built on the first query and then kept in the node.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param caps Capabilities of the device
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _get_caps, (dmfsi_context_t ctx, void* fp, dmdevfs_caps_t* caps));
+
+/**
+ * @brief Get the I/O capabilities of a device by its path
+ *
+ * Same as dmdevfs_get_caps() without opening a file.
+ */
+dmod_dmdevfs_api(1.0, int, _get_path_caps, (dmfsi_context_t ctx, const char* path, dmdevfs_caps_t* caps));
+
+/**
+ * @brief Get the statistics of a device by its path
+ *
+ * When the node has a `slow_call_ms` threshold, every driver call of the node
+ * is timed, and calls that take at least the threshold are counted and logged. A call still in progress
+ * is reported as soon as the threshold has passed by the next call to the
+ * node or by this function, so a watchdog task of the host calling it
+ * periodically finds hung drivers before the application times out.
+ *
+ * @param ctx File system context
+ * @param path Path of the device
+ * @param stats Statistics of the device
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _get_stats, (dmfsi_context_t ctx, const char* path, dmdevfs_stats_t* stats));
+
+/**
+ * @brief Tag an open file for the accounting of its I/O
+ *
+ * The reads and writes of every file are added up per device and tag, so the
+ * modules sharing a mount can be told apart. DMFSI calls do not identify the
+ * calling module, so a module tags its files itself, typically with its module
+ * name, right after opening them. Files are untagged ("") until then.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param tag Tag of the file (NULL or "" - untagged), shorter than DMOD_MAX_MODULE_NAME_LENGTH
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _set_tag, (dmfsi_context_t ctx, void* fp, const char* tag));
+
+/**
+ * @brief Get the I/O of the files of a device with one tag
+ *
+ * @param ctx File system context
+ * @param path Path of the device
+ * @param index Index of the tag, in order of the first use (0, 1, ...)
+ * @param stats I/O of the files with the tag
+ * @return DMFSI_OK on success, DMFSI_ERR_NOT_FOUND past the last tag, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _get_tag_stats, (dmfsi_context_t ctx, const char* path, size_t index, dmdevfs_tag_stats_t* stats));
+
+/**
+ * @brief Get the sampled access pattern of a device
+ *
+ * Recorded for seekable devices configured with `access_stats = true`. One of
+ * every `access_sample` reads and writes of the applications is recorded: its
+ * size class, and each bucket of the device (erase blocks, merged to at most
+ * DMDEVFS_ACCESS_MAX_BUCKETS buckets) it touched, in the heatmap.
+ *
+ * @param ctx File system context
+ * @param path Path of the device
+ * @param stats Sizes of the requests and layout of the heatmap
+ * @param reads Recorded reads per bucket (NULL - not needed)
+ * @param writes Recorded writes per bucket (NULL - not needed)
+ * @param count Size of `reads` and `writes` (buckets past it are not copied)
+ * @return DMFSI_OK on success, DMFSI_ERR_NOT_FOUND if not recorded, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _get_access_stats, (dmfsi_context_t ctx, const char* path, dmdevfs_access_stats_t* stats, uint32_t* reads, uint32_t* writes, size_t count));
+
+/**
+ * @brief Select the write mode of an open file
+ *
+ * In the differential mode, written data is split into erase blocks of the
+ * device (its preferred transfer size, or DMDEVFS_DIFF_BLOCK_SIZE, if it has no
+ * erase blocks). Each block is compared with the current contents of the
+ * device, from the shadow or read back through the driver, and only blocks
+ * that differ are written; the position simply moves over the others. The
+ * mode needs a seekable device (see dmdevfs_get_caps()). Files of nodes
+ * configured with `differential = true` are opened in this mode.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param mode DMDEVFS_WRITE_DIRECT or DMDEVFS_WRITE_DIFFERENTIAL
+ * @return DMFSI_OK on success, error code otherwise
+ */
+dmod_dmdevfs_api(1.0, int, _set_write_mode, (dmfsi_context_t ctx, void* fp, int mode));
+
+/**
+ * @brief Allocate a buffer meeting the alignment of the device of a file
+ *
+ * Buffers are aligned to the `buffer_alignment` of the node (cache line or DMA
+ * alignment of the driver), so drivers can transfer them without bouncing.
+ * Released buffers are kept in a per-node pool and reused, the same pool that
+ * provides the internal buffers of dmdevfs. Buffers must be released before
+ * the last mount of the configuration is deinitialized; buffers left over are
+ * reported and freed then.
+ *
+ * @param ctx File system context
+ * @param fp Open file
+ * @param size Size of the buffer in bytes
+ * @return Buffer, or NULL on error
+ */
+dmod_dmdevfs_api(1.0, void*, _buffer_alloc, (dmfsi_context_t ctx, void* fp, size_t size));
+
+/**
+ * @brief Release a buffer from dmdevfs_buffer_alloc() to the pool of its node
+ *
+ * @param ctx File system context
+ * @param fp Open file of the device the buffer was allocated for
+ * @param buffer Buffer to release
+ * @return DMFSI_OK on success, DMFSI_ERR_INVALID if the buffer was not lent
+ *         for the device or is already released
+ */
+dmod_dmdevfs_api(1.0, int, _buffer_free, (dmfsi_context_t ctx, void* fp, void* buffer));
+
 #ifdef __cplusplus
 }
 #endif
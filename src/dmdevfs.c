@@ -15,6 +15,10 @@
 #include "dmlist.h"
 #include "dmini.h"
 #include "dmdrvi.h"
+#include "dmdevfs_kernels.h"
+#include "dmdevfs_lz4.h"
+#include "dmdevfs_hostdev.h"
+#include "dmdevfs_trace.h"
 #include <string.h>
 
 /** 
@@ -23,40 +27,519 @@
 #define DMDEVFS_CONTEXT_MAGIC 0x444D4456  // 'DMDV'
 #define ROOT_DIRECTORY_NAME "/"
 #define MAX_PATH_LENGTH     (DMOD_MAX_MODULE_NAME_LENGTH + 20)
+#define PATH_HASH_BASIS     2166136261u     // FNV-1a offset basis
+#define PATH_HASH_PRIME     16777619u       // FNV-1a prime
+
+/**
+ * @brief INI section with the options interpreted by dmdevfs itself
+ */
+#define DMDEVFS_CONFIG_SECTION      "dmdevfs"
+
+/**
+ * @brief Size of the per-handle buffer for raw samples read from the driver
+ */
+#ifndef DMDEVFS_STAGE_BUFFER_SIZE
+#   define DMDEVFS_STAGE_BUFFER_SIZE    512
+#endif
+
+/**
+ * @brief Default alignment of the buffers of a node
+ */
+#ifndef DMDEVFS_BUFFER_ALIGNMENT
+#   define DMDEVFS_BUFFER_ALIGNMENT     16
+#endif
+
+/**
+ * @brief Default number of released buffers kept in the pool of a node
+ */
+#ifndef DMDEVFS_POOL_MAX_FREE
+#   define DMDEVFS_POOL_MAX_FREE        4
+#endif
+
+/**
+ * @brief Period over which the completion rate of a file is measured
+ */
+#ifndef DMDEVFS_COMPLETION_WINDOW_MS
+#   define DMDEVFS_COMPLETION_WINDOW_MS 100
+#endif
+
+/**
+ * @brief Memory that the buffers of all open files may grow to with `auto_buffer`
+ */
+#ifndef DMDEVFS_BUFFER_BUDGET
+#   define DMDEVFS_BUFFER_BUDGET        (128 * 1024)
+#endif
+
+/**
+ * @brief Number of driver transfers between two buffer size decisions
+ */
+#ifndef DMDEVFS_TUNE_TRANSFERS
+#   define DMDEVFS_TUNE_TRANSFERS       16
+#endif
+
+/**
+ * @brief Smallest and largest transfer size tried by `calibrate = true`
+ */
+#ifndef DMDEVFS_CALIBRATE_MIN_SIZE
+#   define DMDEVFS_CALIBRATE_MIN_SIZE   64
+#endif
+#ifndef DMDEVFS_CALIBRATE_MAX_SIZE
+#   define DMDEVFS_CALIBRATE_MAX_SIZE   (8 * 1024)
+#endif
+
+/**
+ * @brief Time spent measuring each transfer size
+ */
+#ifndef DMDEVFS_CALIBRATE_TIME_MS
+#   define DMDEVFS_CALIBRATE_TIME_MS    20
+#endif
+
+/**
+ * @brief Block compared by differential writes when the device has no erase or transfer size
+ */
+#ifndef DMDEVFS_DIFF_BLOCK_SIZE
+#   define DMDEVFS_DIFF_BLOCK_SIZE      256
+#endif
+
+/**
+ * @brief Read-ahead window of files advised as sequential when the node has no `readahead`
+ */
+#ifndef DMDEVFS_READAHEAD_SIZE
+#   define DMDEVFS_READAHEAD_SIZE       4096
+#endif
+
+/**
+ * @brief Largest decoded block of a compressed image
+ */
+#ifndef DMDEVFS_IMAGE_MAX_BLOCK
+#   define DMDEVFS_IMAGE_MAX_BLOCK      (64 * 1024)
+#endif
+
+/**
+ * @brief Maximum number of child nodes published by one driver context
+ */
+#ifndef DMDEVFS_MAX_CHILDREN
+#   define DMDEVFS_MAX_CHILDREN         64
+#endif
+
+/**
+ * @brief Value of the `type` option selecting the Linux host device backend
+ */
+#define HOSTDEV_TYPE_NAME           "hostdev"
+
+/**
+ * @brief Maximum size of a device kept in RAM with `shadow = true`
+ */
+#ifndef DMDEVFS_SHADOW_MAX_SIZE
+#   define DMDEVFS_SHADOW_MAX_SIZE      (64 * 1024)
+#endif
+
+/**
+ * @brief Dirty bytes of a mount above which dmdevfs_writeback() writes all files
+ */
+#ifndef DMDEVFS_DIRTY_LIMIT
+#   define DMDEVFS_DIRTY_LIMIT          (64 * 1024)
+#endif
+
+/**
+ * @brief Default age of buffered data written by dmdevfs_writeback()
+ */
+#ifndef DMDEVFS_DIRTY_AGE_MS
+#   define DMDEVFS_DIRTY_AGE_MS         500
+#endif
+
+/**
+ * @brief Duration of a driver call reported as slow when the node has no `slow_call_ms` (0 - calls are not watched)
+ */
+#ifndef DMDEVFS_SLOW_CALL_MS
+#   define DMDEVFS_SLOW_CALL_MS         0
+#endif
+
+/**
+ * @brief Maximum number of driver calls of a node watched at the same time
+ */
+#ifndef DMDEVFS_WATCHED_CALLS
+#   define DMDEVFS_WATCHED_CALLS        4
+#endif
+
+/**
+ * @brief Requests per recorded request of the access statistics when the node has no `access_sample`
+ */
+#ifndef DMDEVFS_ACCESS_SAMPLE
+#   define DMDEVFS_ACCESS_SAMPLE        8
+#endif
+
+/**
+ * @brief Bucket of the access heatmap of devices without erase blocks
+ */
+#ifndef DMDEVFS_ACCESS_BUCKET_SIZE
+#   define DMDEVFS_ACCESS_BUCKET_SIZE   4096
+#endif
+
+/**
+ * @brief Maximum number of buckets of the access heatmap of a device
+ */
+#ifndef DMDEVFS_ACCESS_MAX_BUCKETS
+#   define DMDEVFS_ACCESS_MAX_BUCKETS   256
+#endif
+
+/**
+ * @brief Maximum number of FIR filter coefficients
+ */
+#ifndef DMDEVFS_MAX_FIR_TAPS
+#   define DMDEVFS_MAX_FIR_TAPS         64
+#endif
 
 /**
  * @brief Type definition for path strings
  */
 typedef char path_t[MAX_PATH_LENGTH];
 
-typedef struct 
+/**
+ * @brief Path in the canonical form used by all lookups
+ * 
+ * The canonical form has no leading, trailing or duplicate slashes and no
+ * `.` or `..` segments, e.g. "dmspiflash0/1". The root directory is "".
+ */
+typedef struct
+{
+    path_t path;            // Canonical path
+    size_t length;          // Length of the path
+    uint32_t hash;          // Hash of the path
+} canonical_path_t;
+
+/**
+ * @brief Sample conversion declared in the driver configuration
+ */
+typedef struct
+{
+    dmdevfs_sample_format_t source_format;  // Format delivered by the driver (NONE - no conversion)
+    dmdevfs_sample_format_t target_format;  // Format returned to the application
+    size_t channels;                        // Number of interleaved channels in a frame
+} sample_config_t;
+
+/**
+ * @brief Filters supported by the filter stage
+ */
+typedef enum
+{
+    FILTER_NONE = 0,        // No filtering
+    FILTER_AVERAGE,         // Boxcar average of each block of input frames
+    FILTER_MIN,             // Minimum of each block of input frames
+    FILTER_MAX,             // Maximum of each block of input frames
+    FILTER_DECIMATE,        // First frame of each block of input frames
+    FILTER_FIR,             // FIR filter evaluated once per block of input frames
+} filter_type_t;
+
+/**
+ * @brief Filter declared in the driver configuration
+ */
+typedef struct
+{
+    filter_type_t type;     // Filter type
+    size_t decimation;      // Number of input frames per output frame
+    size_t taps_count;      // Number of FIR coefficients
+    float* taps;            // FIR coefficients, oldest sample first
+} filter_config_t;
+
+/**
+ * @brief Write-back buffering declared in the driver configuration
+ */
+typedef struct
+{
+    size_t buffer_size;     // Size of the buffer of each file (0 - writes go to the driver)
+    size_t dirty_bytes;     // Buffered bytes of a file that are written by the flusher
+    uint32_t dirty_age_ms;  // Age of buffered data that is written by the flusher
+} writeback_config_t;
+
+/**
+ * @brief Adaptive completion mode declared in the driver configuration
+ */
+typedef struct
+{
+    uint32_t busy_poll_rate;    // Completions per second that switch to polling (0 - never)
+    uint32_t spin_ms;           // Time polled before waiting for a notification
+    uint32_t budget_percent;    // Share of the time that may be spent polling
+} completion_config_t;
+
+/**
+ * @brief Completion mode of a file
+ */
+typedef struct
+{
+    bool busy_poll;             // Completions are polled before waiting for a notification
+    uint64_t window_start;      // Start of the measurement window
+    uint32_t completions;       // Completions observed in the window
+    uint32_t spent_ms;          // Time spent polling in the window
+} completion_state_t;
+
+/**
+ * @brief Buffer size tuning declared in the driver configuration
+ */
+typedef struct
+{
+    bool enabled;               // Buffer sizes follow the observed transfers
+    size_t min_size;            // Smallest size of a buffer
+    size_t max_size;            // Largest size of a buffer
+} tuning_config_t;
+
+/**
+ * @brief Transfers observed through a buffer since the last size decision
+ */
+typedef struct
+{
+    uint32_t transfers;         // Driver transfers
+    uint32_t full;              // Transfers limited by the size of the buffer
+    size_t bytes;               // Bytes transferred
+    uint64_t busy_ms;           // Time spent in the driver
+    uint64_t last_rate;         // Throughput before the buffer was grown (0 if not grown)
+    size_t limit;               // Size at which growing stopped paying off (0 - no limit)
+} buffer_tuner_t;
+
+/**
+ * @brief Capabilities declared in the driver configuration (-1 - not given)
+ */
+typedef struct
+{
+    int io_size;                // Preferred transfer size
+    int max_io_size;            // Largest transfer
+    int io_alignment;           // Alignment of offsets and sizes
+    int erase_size;             // Size of an erase block
+    int queue_depth;            // Requests kept in flight by the hardware
+    int seekable;               // The device has a position (0 or 1)
+} caps_config_t;
+
+/**
+ * @brief Block index of a compressed image stored on a device
+ */
+typedef struct
+{
+    size_t block_size;          // Decoded size of a block
+    size_t image_size;          // Decoded size of the image
+    size_t block_count;         // Number of blocks
+    size_t max_stored;          // Largest stored block
+    uint32_t* offsets;          // Device offset of each block, and the end of the last one
+} compressed_image_t;
+
+/**
+ * @brief Driver call in progress
+ */
+typedef struct
+{
+    int op;                     // DMDEVFS_OP_* of the call (DMDEVFS_OP_NONE - slot is free)
+    uint64_t start;             // Start of the call
+    bool reported;              // The call was reported as slow while in progress
+} driver_call_t;
+
+/**
+ * @brief Watch of the driver calls of a node
+ */
+typedef struct
+{
+    uint32_t threshold_ms;                      // Duration of a slow call (0 - calls are not watched)
+    driver_call_t calls[DMDEVFS_WATCHED_CALLS]; // Calls in progress
+    uint32_t slow_calls;                        // Slow calls found
+    int last_slow_op;                           // DMDEVFS_OP_* of the last slow call
+    uint32_t last_slow_ms;                      // Duration of the last slow call
+    uint32_t max_ms;                            // Longest call
+} call_watch_t;
+
+/**
+ * @brief I/O of the files of a node that have the same tag
+ */
+typedef struct tag_account
+{
+    struct tag_account* next;   // Next tag of the node
+    dmdevfs_tag_stats_t stats;  // Tag and accumulated I/O
+} tag_account_t;
+
+/**
+ * @brief Sampled access pattern of a seekable device
+ */
+typedef struct
+{
+    uint32_t sample;            // Requests per recorded request
+    uint32_t countdown;         // Requests until the next recorded one
+    uint32_t sampled;           // Recorded requests
+    size_t bucket_size;         // Bytes of the device per bucket
+    size_t bucket_count;        // Number of buckets
+    uint32_t read_sizes[DMDEVFS_SIZE_CLASSES];  // Recorded reads per size class
+    uint32_t write_sizes[DMDEVFS_SIZE_CLASSES]; // Recorded writes per size class
+    uint32_t* reads;            // Recorded reads touching each bucket
+    uint32_t* writes;           // Recorded writes touching each bucket
+} access_stats_t;
+
+/**
+ * @brief Header placed in front of each buffer of a pool
+ */
+typedef struct pool_block
+{
+    struct pool_block* next;    // Next released or lent buffer of the pool
+    void* base;                 // Address of the allocation
+    size_t capacity;            // Usable size of the buffer
+    struct buffer_pool* pool;   // Pool owning the buffer
+} pool_block_t;
+
+/**
+ * @brief Pool of aligned buffers of a node
+ */
+typedef struct buffer_pool
+{
+    size_t alignment;           // Alignment of the buffers (power of two)
+    size_t max_free;            // Maximum number of released buffers kept
+    size_t free_count;          // Number of released buffers kept
+    pool_block_t* free;         // Released buffers
+    size_t lent_count;          // Number of buffers lent to applications
+    pool_block_t* lent;         // Buffers lent to applications by dmdevfs_buffer_alloc()
+} buffer_pool_t;
+
+typedef struct driver_node
 {
     dmdrvi_context_t driver_context;    // Driver-specific context
-    Dmod_Context_t*  driver;            // Driver module context
+    Dmod_Context_t*  driver;            // Driver module context (NULL for host devices)
+    dmdevfs_hostdev_t* hostdev;         // Linux host device (NULL for driver modules)
     dmdrvi_dev_num_t dev_num;           // Device number assigned to the driver
     bool was_loaded;                    // Indicates if the driver was loaded by dmdevfs
     bool was_enabled;                   // Indicates if the driver was enabled by dmdevfs
-    path_t path;                        // Path associated with the driver
+    path_t path;                        // Canonical path associated with the driver
+    size_t path_length;                 // Length of the path
+    uint32_t path_hash;                 // Hash of the path
+    size_t parent_length;               // Length of the parent directory (prefix of the path)
+    uint32_t parent_hash;               // Hash of the parent directory
+    sample_config_t samples;            // Sample conversion applied on read
+    filter_config_t filter;             // Filter applied on read after the conversion
+    uint8_t* shadow;                    // Copy of the device serving reads (NULL if not shadowed)
+    size_t shadow_size;                 // Size of the copy in bytes
+    writeback_config_t write_back;      // Write-back buffering of the files
+    buffer_pool_t pool;                 // Buffers meeting the alignment of the driver
+    completion_config_t completion;     // Switching between notifications and polling
+    tuning_config_t tuning;             // Sizing of the buffers of the files
+    size_t transfer_size;               // Best size of internal transfers (0 - not calibrated)
+    size_t transfer_alignment;          // Device offset alignment of internal transfers (1 - any)
+    caps_config_t caps_config;          // Capabilities given in the configuration
+    dmdevfs_caps_t caps;                // Capabilities of the device (valid if caps_ready)
+    bool caps_ready;                    // The capabilities were built
+    bool differential;                  // Files are opened in the differential write mode
+    compressed_image_t* image;          // Compressed image served decoded (NULL if not compressed)
+    size_t readahead;                   // Read-ahead window of files without advice (0 - off)
+    struct driver_node* parent;         // Node owning the driver context (NULL if this node owns it)
+    dmdevfs_child_t child;              // Child of the driver context served by the node (if parent)
+    size_t child_count;                 // Children published by the driver (the node is only their directory)
+    call_watch_t calls;                 // Detection of slow driver calls
+    tag_account_t* accounts;            // I/O of the files per tag, in order of the first use
+    access_stats_t* access;             // Sampled access pattern (NULL if not recorded)
 } driver_node_t;
 
 typedef struct
 {
     driver_node_t* driver;   // Last driver
-    char* directory_path;   // Directory path
+    canonical_path_t directory; // Directory path
 } directory_node_t;
 
 /**
- * @brief File handle structure for file operations
+ * @brief Per-channel accumulator of the filter stage
  */
 typedef struct
+{
+    int64_t sum;                // Sum of integer samples
+    double float_sum;           // Sum of float samples
+    int32_t extreme;            // Min/max or the kept integer sample
+    float float_extreme;        // Min/max or the kept float sample
+} filter_accumulator_t;
+
+/**
+ * @brief Conversion stage state of an open file
+ */
+typedef struct
+{
+    uint8_t* buffer;            // Raw samples read from the driver
+    size_t capacity;            // Size of the buffer in bytes
+    size_t pending;             // Bytes of an incomplete frame kept at the start of the buffer
+    void* converted;            // Converted frames waiting for the filter (NULL without filter)
+    filter_accumulator_t* accumulators; // Filter accumulators, one per channel
+    float* history;             // FIR history, two copies of the window per channel
+    size_t history_position;    // Position of the newest sample in the FIR window
+    size_t filter_count;        // Input frames accumulated for the next output frame
+    buffer_tuner_t tuner;       // Transfers observed for sizing the buffer
+} convert_stage_t;
+
+/**
+ * @brief File handle structure for file operations
+ */
+typedef struct file_handle
 {
     driver_node_t* driver;      // Driver associated with this file
-    void* driver_handle;        // Driver device handle
+    void* driver_handle;        // Driver device handle (dmdevfs_hostdev_file_t* for host devices)
     const char* path;           // File path
     int mode;                   // File open mode
     int attr;                   // File attributes
+    convert_stage_t* convert;   // Sample conversion stage (NULL if not configured)
+    void* mapping;              // Memory mapping of the device (NULL if not mapped)
+    size_t mapping_length;      // Length of the mapping in bytes
+    bool mapping_is_copy;       // The mapping is a copy of the device owned by the handle
+    size_t position;            // Position of the application in the device
+    size_t device_position;     // Position of the driver handle (differs for shadowed devices)
+    uint8_t* write_buffer;      // Write-back buffer (NULL if writes go to the driver)
+    size_t write_capacity;      // Size of the write-back buffer
+    buffer_tuner_t write_tuner; // Transfers observed for sizing the write-back buffer
+    size_t dirty_length;        // Number of bytes in the write-back buffer
+    uint64_t dirty_since;       // Time of the oldest byte in the write-back buffer
+    int write_error;            // Error of a write-back not yet reported to the application
+    struct file_handle* next_dirty; // Next file with buffered data in the mount
+    completion_state_t completion;  // Current completion mode and its statistics
+    bool differential;          // Blocks equal to the contents of the device are not written
+    size_t diff_block;          // Size of the compared blocks
+    uint8_t* diff_buffer;       // Current contents of a block (NULL for shadowed devices)
+    uint8_t* unpacked;          // Last decoded block of a compressed image (NULL if none)
+    size_t unpacked_block;      // Index of the decoded block
+    size_t unpacked_length;     // Decoded size of the block
+    uint8_t* packed;            // Stored block read from the device
+    bool noreuse;               // Decoded blocks are released as soon as they are read
+    uint8_t* readahead;         // Data read from the device ahead of the position (NULL if none)
+    size_t readahead_capacity;  // Size of the read-ahead buffer
+    size_t readahead_start;     // Position of the first byte in the read-ahead buffer
+    size_t readahead_length;    // Number of bytes in the read-ahead buffer
+    size_t readahead_window;    // Size of reads made ahead of the position (0 - off)
+    tag_account_t* account;     // I/O of the files with the tag of this file (NULL - not accounted)
 } file_handle_t;
 
+/**
+ * @brief Configuration directory waiting to be scanned
+ */
+typedef struct
+{
+    path_t path;                                    // Path of the directory
+    char driver_name[DMOD_MAX_MODULE_NAME_LENGTH];  // Default driver for the directory (empty if none)
+} config_dir_t;
+
+/**
+ * @brief Directory of the namespace
+ */
+typedef struct
+{
+    const char* path;           // Canonical path (prefix of the path of a node in the directory)
+    size_t length;              // Length of the path
+    uint32_t hash;              // Hash of the path
+    uint32_t child_count;       // Number of nodes and subdirectories in the directory
+} directory_entry_t;
+
+/**
+ * @brief Drivers configured from one configuration path
+ * 
+ * Mounts of the same configuration path share a single set, so the drivers are
+ * created and probed only once. Only the handles are kept per mount.
+ */
+typedef struct
+{
+    char* config_path;          // Path with the configuration files
+    dmlist_context_t* drivers;  // List of loaded drivers
+    driver_node_t** node_index; // Open-addressing table of the nodes by path hash
+    directory_entry_t* directory_index; // Open-addressing table of the directories by path hash
+    size_t index_mask;          // Size of the tables minus one (the size is a power of two)
+    uint32_t ref_count;         // Number of mounts using the set
+    bool ready;                 // Drivers are configured (the set can be shared)
+} driver_set_t;
+
 /**
  * @brief File system context structure
  */
@@ -64,16 +547,53 @@ struct dmfsi_context
 {
     uint32_t    magic;
     char* config_path;          // Path with the configuration files
-    dmlist_context_t* drivers;  // List of loaded drivers
+    dmlist_context_t* drivers;  // List of loaded drivers (owned by the driver set)
+    driver_set_t* driver_set;   // Driver set shared with other mounts of the same path
+    file_handle_t* dirty_files; // Files with buffered data, oldest first
+    size_t dirty_bytes;         // Number of buffered bytes in all files
 };
 
+/**
+ * @brief Driver sets of all mounts (NULL when nothing is mounted)
+ * 
+ * Guarded by critical sections, as mounts may be done from different tasks.
+ */
+static dmlist_context_t* driver_sets = NULL;
+
+/**
+ * @brief Bytes of the staging and write-back buffers of all open files
+ * 
+ * Shared by all mounts, so only accessed inside critical sections.
+ */
+static size_t buffer_bytes = 0;
+
 
 // ============================================================================
 //                      Local prototypes
 // ============================================================================
-static int configure_drivers(dmfsi_context_t ctx, const char* driver_name, const char* config_path);
+static driver_set_t* acquire_driver_set(const char* config_path);
+static void release_driver_set(driver_set_t* set);
+static driver_set_t* share_driver_set(const char* config_path, uint32_t* mounts);
+static driver_set_t* use_shared_set(driver_set_t* set, const char* config_path, uint32_t mounts);
+static bool register_driver_set(driver_set_t* set);
+static driver_set_t* create_driver_set(const char* config_path);
+static void destroy_driver_set(driver_set_t* set);
+static int compare_driver_set_path( const void* data, const void* user_data );
+static int compare_same_item( const void* data, const void* user_data );
+static int match_any_item( const void* data, const void* user_data );
+static int configure_drivers(driver_set_t* set, const char* config_path);
+static int queue_config_dir(dmlist_context_t* pending, const char* path, const char* driver_name);
+static int configure_directory(driver_set_t* set, const config_dir_t* config_dir, dmlist_context_t* pending);
 static driver_node_t* configure_driver(const char* driver_name, dmini_context_t config_ctx);
-static int unconfigure_drivers(dmfsi_context_t ctx);
+static driver_node_t* configure_hostdev(const char* node_name, dmini_context_t config_ctx);
+static void free_driver_node(driver_node_t* node);
+static void destroy_driver_node(driver_node_t* node);
+static size_t publish_children(driver_set_t* set, driver_node_t* node);
+static driver_node_t* create_child_node(driver_node_t* parent, const dmdevfs_child_t* child);
+static void free_driver_context(driver_node_t* node);
+static void release_driver_module(driver_node_t* node);
+static const char* get_node_name(const driver_node_t* node);
+static int unconfigure_drivers(driver_set_t* set);
 static bool is_file(const char* path);
 static bool is_driver( const char* name);
 static void read_base_name(const char* path, char* base_name, size_t name_size);
@@ -84,14 +604,108 @@ static void cleanup_driver_module(const char* driver_name, bool was_loaded, bool
 static int read_driver_parent_directory( const driver_node_t* node, char* path_buffer, size_t buffer_size );
 static int read_driver_node_path( const driver_node_t* node, char* path_buffer, size_t buffer_size );
 static int compare_paths_ignore_trailing_slash( const char* path1, const char* path2 );
+static int canonicalize_path( const char* path, canonical_path_t* canonical );
+static uint32_t hash_path( const char* path, size_t length );
+static int set_node_path( driver_node_t* node );
+static void store_node_path( driver_node_t* node, const canonical_path_t* canonical );
+static bool is_node_in_directory( const driver_node_t* node, const canonical_path_t* directory );
+static int build_path_indexes( driver_set_t* set );
+static void free_path_indexes( driver_set_t* set );
+static directory_entry_t* add_directory( driver_set_t* set, const char* path, size_t length, bool* created );
+static const directory_entry_t* find_directory( dmfsi_context_t ctx, const canonical_path_t* path );
 static int compare_driver_directory( const void* data, const void* user_data );
-static int compare_driver_node_path( const void* data, const void* user_data );
 static int compare_driver(const void* data, const void* user_data );
-static bool is_directory( dmfsi_context_t ctx, const char* path );
-static driver_node_t* get_next_driver_node( dmfsi_context_t ctx, driver_node_t* current, const char* dir_path );
+static bool is_directory( dmfsi_context_t ctx, const canonical_path_t* path );
+static driver_node_t* get_next_driver_node( dmfsi_context_t ctx, driver_node_t* current, const canonical_path_t* directory );
 
-static driver_node_t* find_driver_node( dmfsi_context_t ctx, const char* path );
+static driver_node_t* find_driver_node( dmfsi_context_t ctx, const canonical_path_t* path );
 static int driver_stat( driver_node_t* context, const char* path, dmdrvi_stat_t* stat );
+static int driver_open( driver_node_t* node, int mode, void** driver_handle );
+static void driver_close( file_handle_t* handle );
+static int driver_read( file_handle_t* handle, void* buffer, size_t size, size_t* read );
+static int device_read( file_handle_t* handle, void* buffer, size_t size, size_t* read );
+static int sync_device_position( file_handle_t* handle );
+static int driver_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written );
+static int device_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written );
+static int differential_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written );
+static int read_current_block( file_handle_t* handle, const void* data, size_t size, bool* equal );
+static int set_write_mode( file_handle_t* handle, int mode );
+static int driver_flush( file_handle_t* handle );
+static int driver_ioctl( file_handle_t* handle, int command, void* arg, int* result );
+static int device_poll( file_handle_t* handle, int events, int timeout_ms );
+static int wait_completion( file_handle_t* handle, int events, int timeout_ms );
+static void update_completion_mode( file_handle_t* handle, uint64_t now );
+static void read_completion_config( dmini_context_t config_ctx, completion_config_t* config );
+static int open_internal_handle( driver_node_t* node, int mode, file_handle_t* handle );
+static void close_internal_handle( file_handle_t* handle );
+static int read_device_copy( driver_node_t* node, int mode, void** data, size_t* size );
+static int load_shadow( driver_node_t* node );
+static int load_image_index( driver_node_t* node );
+static void free_image_index( driver_node_t* node );
+static int read_image( file_handle_t* handle, void* buffer, size_t size, size_t* read );
+static int unpack_block( file_handle_t* handle, size_t block );
+static int read_device_range( file_handle_t* handle, size_t offset, uint8_t* buffer, size_t size );
+static void release_unpacked( file_handle_t* handle );
+static int seek_device( file_handle_t* handle, size_t offset, uint8_t* scratch, size_t scratch_size );
+static bool can_read_ahead( driver_node_t* node );
+static int set_readahead( file_handle_t* handle, size_t window );
+static int read_ahead( file_handle_t* handle, void* buffer, size_t size, size_t* read );
+static int drop_readahead( file_handle_t* handle );
+static void release_readahead( file_handle_t* handle );
+static int prefetch( file_handle_t* handle, size_t offset, size_t end );
+static int evict( file_handle_t* handle, size_t offset, size_t end );
+static uint32_t read_le32( const uint8_t* data );
+static void configure_transfer_size( driver_node_t* node, dmini_context_t config_ctx );
+static size_t calibrate_transfer_size( driver_node_t* node, size_t* alignment );
+static uint64_t measure_read_rate( driver_node_t* node, uint8_t* buffer, size_t device_size, size_t size, size_t skip );
+static size_t transfer_chunk( const driver_node_t* node, size_t position, size_t size );
+static void read_caps_config( dmini_context_t config_ctx, caps_config_t* config );
+static void build_caps( driver_node_t* node );
+static bool read_flag( dmini_context_t config_ctx, const char* name );
+static void release_mapping( file_handle_t* handle );
+
+static int read_sample_config( dmini_context_t config_ctx, sample_config_t* config );
+static void read_writeback_config( dmini_context_t config_ctx, writeback_config_t* config );
+static int buffer_write( dmfsi_context_t ctx, file_handle_t* handle, const void* buffer, size_t size, size_t* written );
+static int flush_write_buffer( dmfsi_context_t ctx, file_handle_t* handle );
+static void discard_write_buffer( dmfsi_context_t ctx, file_handle_t* handle );
+static int take_flush_error( file_handle_t* handle, int res );
+static int take_write_error( file_handle_t* handle );
+static int read_filter_config( dmini_context_t config_ctx, sample_config_t* samples, filter_config_t* filter );
+static void free_filter_config( filter_config_t* filter );
+static void read_pool_config( dmini_context_t config_ctx, buffer_pool_t* pool );
+static void update_buffer_bytes( size_t released, size_t taken );
+static size_t get_buffer_bytes( void );
+static void* pool_get( buffer_pool_t* pool, size_t size );
+static void pool_put( void* buffer );
+static void* pool_lend( buffer_pool_t* pool, size_t size );
+static bool pool_reclaim( buffer_pool_t* pool, void* buffer );
+static void free_buffer_pool( buffer_pool_t* pool );
+static void read_tuning_config( dmini_context_t config_ctx, tuning_config_t* config );
+static void read_call_watch_config( dmini_context_t config_ctx, call_watch_t* watch );
+static driver_call_t* begin_driver_call( driver_node_t* node, int op );
+static void end_driver_call( driver_node_t* node, driver_call_t* call );
+static size_t take_slow_calls( call_watch_t* watch, uint64_t now, driver_call_t* slow );
+static void count_slow_call( call_watch_t* watch, int op, uint32_t duration_ms );
+static void report_slow_call( driver_node_t* node, int op, uint32_t duration_ms, bool finished );
+static const char* get_op_name( int op );
+static tag_account_t* get_tag_account( driver_node_t* node, const char* tag );
+static void free_tag_accounts( driver_node_t* node );
+static void account_io( file_handle_t* handle, bool write, size_t bytes, uint64_t start );
+static int setup_access_stats( driver_node_t* node, int sample );
+static void record_access( file_handle_t* handle, bool write, size_t offset, size_t size, size_t transferred );
+static size_t get_size_class( size_t size );
+static void record_transfer( buffer_tuner_t* tuner, size_t bytes, uint64_t busy_ms, bool full );
+static size_t tune_buffer( const tuning_config_t* config, buffer_tuner_t* tuner, size_t size );
+static void resize_convert_stage( file_handle_t* handle, size_t capacity );
+static bool parse_float( const char** text, float* value );
+static convert_stage_t* create_convert_stage( const sample_config_t* config, const filter_config_t* filter, buffer_pool_t* pool, size_t buffer_size );
+static size_t filter_frames( file_handle_t* handle, const void* input, size_t frames, uint8_t* output );
+static int32_t round_to_s32( float value );
+static void store_s32( uint8_t* output, size_t index, int32_t value );
+static void store_f32( uint8_t* output, size_t index, float value );
+static void destroy_convert_stage( convert_stage_t* stage );
+static int read_converted( file_handle_t* handle, void* buffer, size_t size, size_t* read );
 
 // ============================================================================
 //                      Module Interface Implementation
@@ -132,6 +746,7 @@ int dmod_deinit(void)
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, dmfsi_context_t, _init, (const char* config) )
 {
+    DMDEVFS_TRACE(init, config);
     if(config == NULL)
     {
         DMOD_LOG_ERROR("Config path is NULL\n");
@@ -152,19 +767,18 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, dmfsi_context_t, _init, (const cha
     }
     
     ctx->magic = DMDEVFS_CONTEXT_MAGIC;
+    ctx->dirty_files = NULL;
+    ctx->dirty_bytes = 0;
     ctx->config_path = Dmod_StrDup(config);
-    ctx->drivers = dmlist_create(DMOD_MODULE_NAME);
-    
-    int res = configure_drivers(ctx, NULL, ctx->config_path);
-    if (res != DMFSI_OK)
+    ctx->driver_set = acquire_driver_set(ctx->config_path);
+    if (ctx->driver_set == NULL)
     {
         DMOD_LOG_ERROR("Failed to configure drivers\n");
-        unconfigure_drivers(ctx);
-        dmlist_destroy(ctx->drivers);
         Dmod_Free(ctx->config_path);
         Dmod_Free(ctx);
         return NULL;
     }
+    ctx->drivers = ctx->driver_set->drivers;
     
     return ctx;
 }
@@ -182,14 +796,15 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _context_is_valid, (dmfsi_con
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _deinit, (dmfsi_context_t ctx) )
 {
+    DMDEVFS_TRACE(deinit, ctx);
     if (!dmfsi_dmdevfs_context_is_valid(ctx))
     {
         DMOD_LOG_ERROR("Invalid context in deinit\n");
         return DMFSI_ERR_INVALID;
     }
 
-    unconfigure_drivers(ctx);
-    dmlist_destroy(ctx->drivers);
+    release_driver_set(ctx->driver_set);
+    ctx->magic = 0;
     Dmod_Free(ctx->config_path);
     Dmod_Free(ctx);
     return DMFSI_OK;
@@ -200,6 +815,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _deinit, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fopen, (dmfsi_context_t ctx, void** fp, const char* path, int mode, int attr) )
 {
+    DMDEVFS_TRACE(fopen, ctx, fp, path, mode, attr);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in fopen\n");
@@ -213,18 +829,15 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fopen, (dmfsi_context_t ctx,
     }
     
     // Find the driver node for this file
-    driver_node_t* driver_node = find_driver_node(ctx, path);
-    if(driver_node == NULL)
+    canonical_path_t canonical;
+    driver_node_t* driver_node = NULL;
+    if(canonicalize_path(path, &canonical) == DMFSI_OK)
     {
-        DMOD_LOG_ERROR("File not found: %s\n", path);
-        return DMFSI_ERR_NOT_FOUND;
+        driver_node = find_driver_node(ctx, &canonical);
     }
-    
-    // Get the dmdrvi_open function
-    dmod_dmdrvi_open_t dmdrvi_open = Dmod_GetDifFunction(driver_node->driver, dmod_dmdrvi_open_sig);
-    if(dmdrvi_open == NULL)
+    if(driver_node == NULL)
     {
-        DMOD_LOG_ERROR("Driver does not implement dmdrvi_open\n");
+        DMOD_LOG_ERROR("File not found: %s\n", path);
         return DMFSI_ERR_NOT_FOUND;
     }
     
@@ -236,20 +849,89 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fopen, (dmfsi_context_t ctx,
         return DMFSI_ERR_GENERAL;
     }
     
+    handle->convert = NULL;
+    handle->mapping = NULL;
+    handle->mapping_length = 0;
+    handle->mapping_is_copy = false;
+    handle->position = 0;
+    handle->device_position = 0;
+    handle->write_buffer = NULL;
+    handle->dirty_length = 0;
+    handle->dirty_since = 0;
+    handle->write_error = DMFSI_OK;
+    handle->next_dirty = NULL;
+    memset(&handle->completion, 0, sizeof(completion_state_t));
+    handle->differential = false;
+    handle->diff_block = 0;
+    handle->diff_buffer = NULL;
+    handle->unpacked = NULL;
+    handle->unpacked_block = 0;
+    handle->unpacked_length = 0;
+    handle->packed = NULL;
+    handle->noreuse = false;
+    handle->readahead = NULL;
+    handle->readahead_capacity = 0;
+    handle->readahead_start = 0;
+    handle->readahead_length = 0;
+    handle->readahead_window = 0;
+    if(driver_node->samples.source_format != DMDEVFS_SAMPLE_NONE)
+    {
+        handle->convert = create_convert_stage(&driver_node->samples, &driver_node->filter, &driver_node->pool,
+                                              (driver_node->transfer_size > 0) ? driver_node->transfer_size : DMDEVFS_STAGE_BUFFER_SIZE);
+        if(handle->convert == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate conversion stage for: %s\n", path);
+            Dmod_Free(handle);
+            return DMFSI_ERR_GENERAL;
+        }
+    }
+    handle->write_capacity = driver_node->write_back.buffer_size;
+    memset(&handle->write_tuner, 0, sizeof(buffer_tuner_t));
+    if(handle->write_capacity > 0)
+    {
+        handle->write_buffer = pool_get(&driver_node->pool, handle->write_capacity);
+        if(handle->write_buffer == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate write-back buffer for: %s\n", path);
+            destroy_convert_stage(handle->convert);
+            Dmod_Free(handle);
+            return DMFSI_ERR_GENERAL;
+        }
+        update_buffer_bytes(0, handle->write_capacity);
+    }
+    
     // Open the device through the driver
-    // Note: dmdrvi_open only takes context and flags, returns device handle
-    handle->driver_handle = dmdrvi_open(driver_node->driver_context, mode);
-    if(handle->driver_handle == NULL)
+    int res = driver_open(driver_node, mode, &handle->driver_handle);
+    if(res != DMFSI_OK)
     {
         DMOD_LOG_ERROR("Driver failed to open device: %s\n", path);
+        destroy_convert_stage(handle->convert);
+        if(handle->write_buffer != NULL)
+        {
+            update_buffer_bytes(handle->write_capacity, 0);
+            pool_put(handle->write_buffer);
+        }
         Dmod_Free(handle);
-        return DMFSI_ERR_GENERAL;
+        return res;
     }
     
     handle->driver = driver_node;
     handle->path = Dmod_StrDup(path);
     handle->mode = mode;
     handle->attr = attr;
+    if(driver_node->differential && set_write_mode(handle, DMDEVFS_WRITE_DIFFERENTIAL) != DMFSI_OK)
+    {
+        DMOD_LOG_WARN("Differential writes not available for: %s\n", path);
+    }
+    if(driver_node->readahead > 0)
+    {
+        set_readahead(handle, driver_node->readahead);
+    }
+    handle->account = get_tag_account(driver_node, "");
+    if(handle->account != NULL)
+    {
+        handle->account->stats.files++;
+    }
     
     *fp = handle;
     return DMFSI_OK;
@@ -260,6 +942,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fopen, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fclose, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(fclose, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in fclose\n");
@@ -273,13 +956,14 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fclose, (dmfsi_context_t ctx
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
-    
-    // Get the dmdrvi_close function
-    dmod_dmdrvi_close_t dmdrvi_close = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_close_sig);
-    if(dmdrvi_close != NULL)
+    int result = take_flush_error(handle, flush_write_buffer(ctx, handle));
+    if(handle->dirty_length > 0)
     {
-        dmdrvi_close(handle->driver->driver_context, handle->driver_handle);
+        DMOD_LOG_ERROR("Device did not accept %u buffered bytes before close: %s\n", (unsigned)handle->dirty_length, handle->path);
+        discard_write_buffer(ctx, handle);
     }
+    release_mapping(handle);
+    driver_close(handle);
     
     // Free the path string that was duplicated in fopen
     if(handle->path)
@@ -287,8 +971,21 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fclose, (dmfsi_context_t ctx
         Dmod_Free((void*)handle->path);
     }
     
+    if(handle->write_buffer != NULL)
+    {
+        update_buffer_bytes(handle->write_capacity, 0);
+        pool_put(handle->write_buffer);
+    }
+    set_write_mode(handle, DMDEVFS_WRITE_DIRECT);
+    release_unpacked(handle);
+    release_readahead(handle);
+    destroy_convert_stage(handle->convert);
+    if(handle->account != NULL)
+    {
+        handle->account->stats.files--;
+    }
     Dmod_Free(handle);
-    return DMFSI_OK;
+    return result;
 }
 
 /**
@@ -296,6 +993,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fclose, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fread, (dmfsi_context_t ctx, void* fp, void* buffer, size_t size, size_t* read) )
 {
+    DMDEVFS_TRACE(fread, ctx, fp, buffer, size, read);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in fread\n");
@@ -310,21 +1008,29 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fread, (dmfsi_context_t ctx,
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
-    
-    // Get the dmdrvi_read function
-    dmod_dmdrvi_read_t dmdrvi_read = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_read_sig);
-    if(dmdrvi_read == NULL)
+    uint64_t start = (handle->account != NULL) ? Dmod_GetTimeMs() : 0;
+    size_t offset = handle->position;
+    size_t bytes_read = 0;
+    int result = flush_write_buffer(ctx, handle);
+    if(result != DMFSI_OK)
     {
-        DMOD_LOG_ERROR("Driver does not implement dmdrvi_read\n");
         if(read) *read = 0;
-        return DMFSI_ERR_NOT_FOUND;
+        return result;
     }
     
-    // dmdrvi_read returns size_t (bytes read), not error code
-    size_t bytes_read = dmdrvi_read(handle->driver->driver_context, handle->driver_handle, buffer, size);
+    if(handle->convert != NULL)
+    {
+        result = read_converted(handle, buffer, size, &bytes_read);
+    }
+    else
+    {
+        result = driver_read(handle, buffer, size, &bytes_read);
+    }
     if(read) *read = bytes_read;
+    account_io(handle, false, bytes_read, start);
+    record_access(handle, false, offset, size, bytes_read);
     
-    return DMFSI_OK;
+    return result;
 }
 
 /**
@@ -332,6 +1038,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fread, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fwrite, (dmfsi_context_t ctx, void* fp, const void* buffer, size_t size, size_t* written) )
 {
+    DMDEVFS_TRACE(fwrite, ctx, fp, buffer, size, written);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in fwrite\n");
@@ -346,21 +1053,23 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fwrite, (dmfsi_context_t ctx
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
-    
-    // Get the dmdrvi_write function
-    dmod_dmdrvi_write_t dmdrvi_write = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_write_sig);
-    if(dmdrvi_write == NULL)
+    uint64_t start = (handle->account != NULL) ? Dmod_GetTimeMs() : 0;
+    size_t offset = handle->position;
+    size_t bytes_written = 0;
+    int result;
+    if(handle->write_buffer != NULL)
     {
-        DMOD_LOG_ERROR("Driver does not implement dmdrvi_write\n");
-        if(written) *written = 0;
-        return DMFSI_ERR_NOT_FOUND;
+        result = buffer_write(ctx, handle, buffer, size, &bytes_written);
+    }
+    else
+    {
+        result = driver_write(handle, buffer, size, &bytes_written);
     }
-    
-    // dmdrvi_write returns size_t (bytes written), not error code
-    size_t bytes_written = dmdrvi_write(handle->driver->driver_context, handle->driver_handle, buffer, size);
     if(written) *written = bytes_written;
+    account_io(handle, true, bytes_written, start);
+    record_access(handle, true, offset, size, bytes_written);
     
-    return DMFSI_OK;
+    return result;
 }
 
 /**
@@ -369,6 +1078,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fwrite, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _lseek, (dmfsi_context_t ctx, void* fp, long offset, int whence) )
 {
+    DMDEVFS_TRACE(lseek, ctx, fp, offset, whence);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in lseek\n");
@@ -380,18 +1090,60 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _lseek, (dmfsi_context_t ctx,
         return DMFSI_ERR_INVALID;
     }
     
-    // Device drivers typically don't support seek operations
-    // Return error to indicate operation not supported
-    DMOD_LOG_ERROR("lseek not supported for device drivers\n");
-    return DMFSI_ERR_GENERAL;
-}
-
-/**
- * @brief Get current position in a file
- * @note Not supported for device drivers - devices are typically non-seekable
+    file_handle_t* handle = (file_handle_t*)fp;
+    if(handle->convert != NULL)
+    {
+        DMOD_LOG_ERROR("lseek not supported with sample conversion: %s\n", handle->path);
+        return DMFSI_ERR_GENERAL;
+    }
+    int res = flush_write_buffer(ctx, handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+
+    // Shadowed devices and compressed images move only the position of the
+    // application, the driver follows on the next transfer
+    const driver_node_t* node = handle->driver;
+    if(node->shadow != NULL || node->image != NULL)
+    {
+        long size = (long)((node->image != NULL) ? node->image->image_size : node->shadow_size);
+        long base = (whence == DMFSI_SEEK_CUR) ? (long)handle->position :
+                    (whence == DMFSI_SEEK_END) ? size : 0;
+        if(offset < -base || base + offset > size)
+        {
+            return DMFSI_ERR_INVALID;
+        }
+        handle->position = (size_t)(base + offset);
+        return DMFSI_OK;
+    }
+
+    // The driver is moved relative to the position of the application
+    res = drop_readahead(handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+    dmdevfs_seek_t seek = { offset, whence, -1 };
+    int result = 0;
+    if(driver_ioctl(handle, DMDEVFS_IOCTL_SEEK, &seek, &result) != DMFSI_OK || result != 0 || seek.position < 0)
+    {
+        // Most devices are streams without a position
+        DMOD_LOG_ERROR("lseek not supported for device: %s\n", handle->path);
+        return DMFSI_ERR_GENERAL;
+    }
+    handle->position = (size_t)seek.position;
+    handle->device_position = (size_t)seek.position;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get current position in a file
+ * @note For streaming devices this is the number of bytes transferred so far
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _tell, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(tell, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in tell\n");
@@ -403,9 +1155,9 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _tell, (dmfsi_context_t ctx,
         return -1;
     }
     
-    // Device drivers typically don't support tell operations
-    DMOD_LOG_ERROR("tell not supported for device drivers\n");
-    return -1;
+    // Buffered data is already part of the position of the application
+    file_handle_t* handle = (file_handle_t*)fp;
+    return (long)(handle->position + handle->dirty_length);
 }
 
 /**
@@ -414,6 +1166,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _tell, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _eof, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(eof, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in eof\n");
@@ -425,8 +1178,17 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _eof, (dmfsi_context_t ctx, v
         return 1;
     }
     
-    // Device drivers typically don't have EOF concept
-    // Return 0 (not at EOF) as devices can always potentially provide more data
+    // Only shadowed devices and compressed images have a known end, other
+    // devices can always potentially provide more data
+    file_handle_t* handle = (file_handle_t*)fp;
+    if(handle->driver->image != NULL)
+    {
+        return (handle->position >= handle->driver->image->image_size) ? 1 : 0;
+    }
+    if(handle->driver->shadow != NULL)
+    {
+        return (handle->position >= handle->driver->shadow_size) ? 1 : 0;
+    }
     return 0;
 }
 
@@ -436,6 +1198,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _eof, (dmfsi_context_t ctx, v
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _size, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(size, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in size\n");
@@ -448,6 +1211,14 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _size, (dmfsi_context_t ctx,
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
+    if(handle->driver->image != NULL)
+    {
+        return (long)handle->driver->image->image_size;
+    }
+    if(handle->driver->shadow != NULL)
+    {
+        return (long)handle->driver->shadow_size;
+    }
     
     // Try to get size from stat if available
     dmdrvi_stat_t stat = {0};
@@ -466,6 +1237,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, long, _size, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _getc, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(getc, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in getc\n");
@@ -494,6 +1266,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _getc, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _putc, (dmfsi_context_t ctx, void* fp, char c) )
 {
+    DMDEVFS_TRACE(putc, ctx, fp, c);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in putc\n");
@@ -522,6 +1295,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _putc, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fflush, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(fflush, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in fflush\n");
@@ -534,22 +1308,12 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fflush, (dmfsi_context_t ctx
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
-    
-    // Get the dmdrvi_flush function
-    dmod_dmdrvi_flush_t dmdrvi_flush = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_flush_sig);
-    if(dmdrvi_flush == NULL)
-    {
-        // Flush not supported by driver, return OK
-        return DMFSI_OK;
-    }
-    
-    int result = dmdrvi_flush(handle->driver->driver_context, handle->driver_handle);
-    if(result != 0)
+    int result = take_flush_error(handle, flush_write_buffer(ctx, handle));
+    if(result != DMFSI_OK)
     {
-        return DMFSI_ERR_GENERAL;
+        return result;
     }
-    
-    return DMFSI_OK;
+    return driver_flush(handle);
 }
 
 /**
@@ -558,6 +1322,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _fflush, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _sync, (dmfsi_context_t ctx, void* fp) )
 {
+    DMDEVFS_TRACE(sync, ctx, fp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in sync\n");
@@ -570,22 +1335,14 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _sync, (dmfsi_context_t ctx,
     }
     
     file_handle_t* handle = (file_handle_t*)fp;
-    
-    // Get the dmdrvi_flush function (sync and flush are equivalent for devices)
-    dmod_dmdrvi_flush_t dmdrvi_flush = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_flush_sig);
-    if(dmdrvi_flush == NULL)
-    {
-        // Sync not supported by driver, return OK
-        return DMFSI_OK;
-    }
-    
-    int result = dmdrvi_flush(handle->driver->driver_context, handle->driver_handle);
-    if(result != 0)
+    int result = take_flush_error(handle, flush_write_buffer(ctx, handle));
+    if(result != DMFSI_OK)
     {
-        return DMFSI_ERR_GENERAL;
+        return result;
     }
     
-    return DMFSI_OK;
+    // Sync and flush are equivalent for devices
+    return driver_flush(handle);
 }
 
 /**
@@ -593,16 +1350,24 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _sync, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _opendir, (dmfsi_context_t ctx, void** dp, const char* path) )
 {
+    DMDEVFS_TRACE(opendir, ctx, dp, path);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in opendir\n");
         return DMFSI_ERR_INVALID;
     }
     
-    if (!is_directory(ctx, path))
+    canonical_path_t canonical;
+    if (canonicalize_path(path, &canonical) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Invalid directory path: %s\n", path ? path : "(null)");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if (!is_directory(ctx, &canonical))
     {
         // Check if the path is a file (device node)
-        driver_node_t* driver_node = find_driver_node(ctx, path);
+        driver_node_t* driver_node = find_driver_node(ctx, &canonical);
         if (driver_node != NULL)
         {
             // Path exists but is a file, not a directory
@@ -620,8 +1385,8 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _opendir, (dmfsi_context_t ct
         DMOD_LOG_ERROR("Failed to allocate memory for directory node\n");
         return DMFSI_ERR_GENERAL;
     }
-    dir_node->driver = get_next_driver_node(ctx, NULL, path);
-    dir_node->directory_path = Dmod_StrDup(path);
+    dir_node->directory = canonical;
+    dir_node->driver = get_next_driver_node(ctx, NULL, &dir_node->directory);
     
     *dp = dir_node;
 
@@ -634,6 +1399,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _opendir, (dmfsi_context_t ct
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _readdir, (dmfsi_context_t ctx, void* dp, dmfsi_dir_entry_t* entry) )
 {
+    DMDEVFS_TRACE(readdir, ctx, dp, entry);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in readdir\n");
@@ -647,14 +1413,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _readdir, (dmfsi_context_t ct
     }
     driver_node_t* driver = dir_node->driver;
 
-    path_t parent_dir;
-    if (read_driver_parent_directory(dir_node->driver, parent_dir, sizeof(parent_dir)) != 0)
-    {
-        DMOD_LOG_ERROR("Failed to read parent directory for driver\n");
-        return DMFSI_ERR_GENERAL;
-    }
-
-    bool file_should_be_listed = compare_paths_ignore_trailing_slash(dir_node->directory_path, parent_dir) == 0;
+    bool file_should_be_listed = is_node_in_directory(driver, &dir_node->directory);
     if(file_should_be_listed)
     {
         // Extract basename from the full path for the directory entry
@@ -674,14 +1433,15 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _readdir, (dmfsi_context_t ct
     else 
     {
         // Extract directory name from parent path for subdirectory entries
-        // This handles paths like "dev/" -> "dev"
+        path_t parent_dir;
+        Dmod_SnPrintf(parent_dir, sizeof(parent_dir), "%.*s", (int)driver->parent_length, driver->path);
         read_dir_name_from_path(parent_dir, entry->name, sizeof(entry->name));
         entry->size = 0;
         entry->attr = DMFSI_ATTR_DIRECTORY;
     }
 
     // Move to next driver for subsequent call
-    dir_node->driver = get_next_driver_node(ctx, driver, dir_node->directory_path);
+    dir_node->driver = get_next_driver_node(ctx, driver, &dir_node->directory);
     return DMFSI_OK;
 }
 
@@ -690,6 +1450,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _readdir, (dmfsi_context_t ct
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _closedir, (dmfsi_context_t ctx, void* dp) )
 {
+    DMDEVFS_TRACE(closedir, ctx, dp);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in closedir\n");
@@ -697,7 +1458,6 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _closedir, (dmfsi_context_t c
     }
     
     directory_node_t* dir_node = (directory_node_t*)dp;
-    Dmod_Free(dir_node->directory_path);
     Dmod_Free(dir_node);
     return DMFSI_OK;
 }
@@ -706,7 +1466,8 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _closedir, (dmfsi_context_t c
  * @brief Create a directory
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _mkdir, (dmfsi_context_t ctx, const char* path) )
-{   
+{
+    DMDEVFS_TRACE(mkdir, ctx, path);
     return DMFSI_ERR_INVALID; // Not supported
 }
 
@@ -715,13 +1476,19 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _mkdir, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _direxists, (dmfsi_context_t ctx, const char* path) )
 {
+    DMDEVFS_TRACE(direxists, ctx, path);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in direxists\n");
         return 0;
     }
     
-    return is_directory(ctx, path) ? 1 : 0;
+    canonical_path_t canonical;
+    if (canonicalize_path(path, &canonical) != DMFSI_OK)
+    {
+        return 0;
+    }
+    return is_directory(ctx, &canonical) ? 1 : 0;
 }
 
 /**
@@ -729,15 +1496,30 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _direxists, (dmfsi_context_t
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _stat, (dmfsi_context_t ctx, const char* path, dmfsi_stat_t* stat) )
 {
+    DMDEVFS_TRACE(stat, ctx, path, stat);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in stat\n");
         return DMFSI_ERR_INVALID;
     }
     
-    driver_node_t* driver_node = find_driver_node(ctx, path);
+    canonical_path_t canonical;
+    driver_node_t* driver_node = NULL;
+    const directory_entry_t* directory = NULL;
+    if (canonicalize_path(path, &canonical) == DMFSI_OK)
+    {
+        driver_node = find_driver_node(ctx, &canonical);
+        directory = (driver_node == NULL) ? find_directory(ctx, &canonical) : NULL;
+    }
     if (driver_node == NULL)
     {
+        // Directories are answered from the namespace, without the drivers
+        if (directory != NULL)
+        {
+            stat->size = directory->child_count;
+            stat->attr = DMFSI_ATTR_DIRECTORY;
+            return DMFSI_OK;
+        }
         DMOD_LOG_ERROR("File not found in stat: %s\n", path);
         return DMFSI_ERR_NOT_FOUND;
     }
@@ -761,6 +1543,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _stat, (dmfsi_context_t ctx,
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _unlink, (dmfsi_context_t ctx, const char* path) )
 {
+    DMDEVFS_TRACE(unlink, ctx, path);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in unlink\n");
@@ -784,6 +1567,7 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _unlink, (dmfsi_context_t ctx
  */
 dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _rename, (dmfsi_context_t ctx, const char* oldpath, const char* newpath) )
 {
+    DMDEVFS_TRACE(rename, ctx, oldpath, newpath);
     if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
         DMOD_LOG_ERROR("Invalid context in rename\n");
@@ -803,597 +1587,5111 @@ dmod_dmfsi_dif_api_declaration( 1.0, dmdevfs, int, _rename, (dmfsi_context_t ctx
 
 
 // ============================================================================
-//                      Local functions
+//                      DMDEVFS API Implementation
 // ============================================================================
 
 /**
- * @brief Configure drivers based on the configuration file
+ * @brief Map the device of an open file into memory
  */
-static int configure_drivers(dmfsi_context_t ctx, const char* driver_name, const char* config_path)
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _map, (dmfsi_context_t ctx, void* fp, void** address, size_t* length) )
 {
-    void* dir = Dmod_OpenDir(config_path);
-    if (dir == NULL)
+    DMDEVFS_TRACE(map, ctx, fp, address, length);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
-        DMOD_LOG_ERROR("Failed to open config directory: %s\n", config_path);
-        return DMFSI_ERR_NOT_FOUND;
+        DMOD_LOG_ERROR("Invalid context in map\n");
+        return DMFSI_ERR_INVALID;
     }
 
-    const char* entry;
-    while ((entry = Dmod_ReadDir(dir)) != NULL)
+    if(fp == NULL || address == NULL || length == NULL)
     {
-        // Construct full path for the entry
-        char full_path[MAX_PATH_LENGTH];
-        size_t config_path_len = strlen(config_path);
-        size_t entry_len = strlen(entry);
-        
-        // Check if we need a separator
-        bool needs_separator = (config_path_len > 0 && config_path[config_path_len - 1] != '/');
-        size_t required_len = config_path_len + (needs_separator ? 1 : 0) + entry_len + 1;
-        
-        if (required_len > MAX_PATH_LENGTH)
-        {
-            DMOD_LOG_ERROR("Path too long: %s/%s\n", config_path, entry);
-            continue;
-        }
-        
-        Dmod_SnPrintf(full_path, sizeof(full_path), "%s%s%s", 
-                      config_path, 
-                      needs_separator ? "/" : "", 
-                      entry);
-        
-        if (is_file(full_path))
-        {
-            char module_name[DMOD_MAX_MODULE_NAME_LENGTH];
-            dmini_context_t config_ctx = read_driver_for_config(full_path, module_name, sizeof(module_name), driver_name);
-            if (config_ctx == NULL)
-            {
-                DMOD_LOG_ERROR("Failed to read driver for config: %s\n", full_path);
-                continue;
-            }
+        DMOD_LOG_ERROR("NULL pointer in map\n");
+        return DMFSI_ERR_INVALID;
+    }
 
-            driver_node_t* driver_node = configure_driver(module_name, config_ctx);
-            dmini_destroy(config_ctx);
-            if (driver_node == NULL)
-            {
-                DMOD_LOG_ERROR("Failed to configure driver: %s\n", module_name);
-                continue;
-            }
-            if(!dmlist_push_back(ctx->drivers, driver_node))
-            {
-                DMOD_LOG_ERROR("Failed to add driver to list: %s\n", module_name);
-                Dmod_Free(driver_node);
-                continue;
-            }
+    file_handle_t* handle = (file_handle_t*)fp;
+    int res = flush_write_buffer(ctx, handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+    if(handle->mapping == NULL)
+    {
+        // Prefer the window of directly addressable devices (compressed
+        // images are mapped as a decoded copy)
+        dmdevfs_map_t map = { NULL, 0 };
+        int result = -1;
+        if(handle->driver->image == NULL &&
+           driver_ioctl(handle, DMDEVFS_IOCTL_MAP, &map, &result) == DMFSI_OK && result == 0 && map.address != NULL)
+        {
+            handle->mapping = map.address;
+            handle->mapping_length = map.length;
+            handle->mapping_is_copy = false;
         }
-        else 
+        else
         {
-            // read driver name from directory name
-            char module_name[DMOD_MAX_MODULE_NAME_LENGTH];
-            read_base_name(entry, module_name, sizeof(module_name));
-            if(is_driver(module_name))
-            {
-                driver_name = module_name;
-            }
-            int res = configure_drivers(ctx, driver_name, full_path);
-            if (res != DMFSI_OK)
+            int res = read_device_copy(handle->driver, handle->mode, &handle->mapping, &handle->mapping_length);
+            if(res != DMFSI_OK)
             {
-                DMOD_LOG_ERROR("Failed to configure drivers in directory: %s\n", full_path);
+                DMOD_LOG_ERROR("Failed to map device: %s\n", handle->path);
+                return res;
             }
+            handle->mapping_is_copy = true;
         }
     }
-    Dmod_CloseDir(dir);
+
+    *address = handle->mapping;
+    *length = handle->mapping_length;
     return DMFSI_OK;
 }
 
 /**
- * @brief Configure a single driver based on its name and configuration file
+ * @brief Release the mapping of an open file
  */
-static driver_node_t* configure_driver(const char* driver_name, dmini_context_t config_ctx)
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _unmap, (dmfsi_context_t ctx, void* fp) )
 {
-    DMOD_LOG_VERBOSE("Configuring driver: %s\n", driver_name);
-    bool was_loaded = false;
-    bool was_enabled = false;
-    Dmod_Context_t* driver = prepare_driver_module(driver_name, &was_loaded, &was_enabled);
-    if (driver == NULL)
+    DMDEVFS_TRACE(unmap, ctx, fp);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
-        return NULL;
+        DMOD_LOG_ERROR("Invalid context in unmap\n");
+        return DMFSI_ERR_INVALID;
     }
 
-    dmod_dmdrvi_create_t dmdrvi_create = Dmod_GetDifFunction(driver, dmod_dmdrvi_create_sig);
-    if (dmdrvi_create == NULL)
+    if(fp == NULL)
     {
-        DMOD_LOG_ERROR("Driver module does not implement dmdrvi_create: %s\n", driver_name);
-        cleanup_driver_module(driver_name, was_loaded, was_enabled);
-        return NULL;
+        return DMFSI_ERR_INVALID;
     }
 
-    driver_node_t* driver_node = Dmod_Malloc(sizeof(driver_node_t));
-    if (driver_node == NULL)
+    release_mapping((file_handle_t*)fp);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Wait until an open file is ready for reading or writing
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _poll, (dmfsi_context_t ctx, void* fp, int events, int timeout_ms) )
+{
+    DMDEVFS_TRACE(poll, ctx, fp, events, timeout_ms);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
-        DMOD_LOG_ERROR("Failed to allocate memory for driver node: %s\n", driver_name);
-        cleanup_driver_module(driver_name, was_loaded, was_enabled);
-        return NULL;
+        DMOD_LOG_ERROR("Invalid context in poll\n");
+        return DMFSI_ERR_INVALID;
     }
 
-    driver_node->was_loaded = was_loaded;
-    driver_node->was_enabled = was_enabled;
-    driver_node->driver = driver;
-    driver_node->driver_context = dmdrvi_create(config_ctx, &driver_node->dev_num);
-    if (driver_node->driver_context == NULL)
+    if(fp == NULL)
     {
-        DMOD_LOG_ERROR("Failed to create driver context: %s\n", driver_name);
-        cleanup_driver_module(driver_name, was_loaded, was_enabled);
-        Dmod_Free(driver_node);
-        return NULL;
+        return DMFSI_ERR_INVALID;
     }
-    if(read_driver_node_path( driver_node, driver_node->path, sizeof(driver_node->path) ) != 0)
+
+    file_handle_t* handle = (file_handle_t*)fp;
+    return wait_completion(handle, events, timeout_ms);
+}
+
+/**
+ * @brief Send a device control command to the driver
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _ioctl, (dmfsi_context_t ctx, void* fp, int command, void* arg, int* result) )
+{
+    DMDEVFS_TRACE(ioctl, ctx, fp, command, arg, result);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
-        DMOD_LOG_ERROR("Failed to read driver node path: %s\n", driver_name);
-        dmod_dmdrvi_free_t dmdrvi_free = Dmod_GetDifFunction(driver, dmod_dmdrvi_free_sig);
-        if (dmdrvi_free != NULL)
-        {
-            dmdrvi_free(driver_node->driver_context);
-        }
-        cleanup_driver_module(driver_name, was_loaded, was_enabled);
-        Dmod_Free(driver_node);
-        return NULL;
+        DMOD_LOG_ERROR("Invalid context in ioctl\n");
+        return DMFSI_ERR_INVALID;
     }
 
-    DMOD_LOG_INFO("Configured driver: %s (path: %s)\n", driver_name, driver_node->path);
+    if(fp == NULL || DMDEVFS_IOCTL_IS_RESERVED(command))
+    {
+        return DMFSI_ERR_INVALID;
+    }
 
-    return driver_node;
+    // Commands apply after the data written before them
+    file_handle_t* handle = (file_handle_t*)fp;
+    int res = flush_write_buffer(ctx, handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+    int driver_result = 0;
+    res = driver_ioctl(handle, command, arg, &driver_result);
+    if(result) *result = driver_result;
+    if(res != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Driver does not implement dmdrvi_ioctl: %s\n", handle->path);
+        return res;
+    }
+    return (driver_result == 0) ? DMFSI_OK : DMFSI_ERR_GENERAL;
 }
 
 /**
- * @brief Unconfigure and unload all drivers
+ * @brief Apply a list of device control commands
  */
-static int unconfigure_drivers(dmfsi_context_t ctx)
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _ioctl_list, (dmfsi_context_t ctx, void* fp, dmdevfs_ioctl_cmd_t* commands, size_t count, size_t* applied) )
 {
-    if (ctx == NULL || ctx->drivers == NULL)
+    DMDEVFS_TRACE(ioctl_list, ctx, fp, commands, count, applied);
+    if(applied) *applied = 0;
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
+        DMOD_LOG_ERROR("Invalid context in ioctl_list\n");
         return DMFSI_ERR_INVALID;
     }
 
-    size_t list_size = dmlist_size(ctx->drivers);
-    for (size_t i = 0; i < list_size; i++)
+    if(fp == NULL || (commands == NULL && count > 0))
     {
-        driver_node_t* driver_node = (driver_node_t*)dmlist_get(ctx->drivers, i);
-        if (driver_node != NULL)
+        return DMFSI_ERR_INVALID;
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(DMDEVFS_IOCTL_IS_RESERVED(commands[i].command))
         {
-            dmod_dmdrvi_free_t dmdrvi_free = Dmod_GetDifFunction(driver_node->driver, dmod_dmdrvi_free_sig);
-            if (dmdrvi_free != NULL)
-            {
-                dmdrvi_free(driver_node->driver_context);
-                DMOD_LOG_INFO("Freed driver context for: %s\n", Dmod_GetName(driver_node->driver));
-            }
-            cleanup_driver_module(Dmod_GetName(driver_node->driver), driver_node->was_loaded, driver_node->was_enabled);
-            Dmod_Free(driver_node);
+            return DMFSI_ERR_INVALID;
         }
+        commands[i].result = 0;
+    }
+    if(count == 0)
+    {
+        return DMFSI_OK;
     }
 
-    dmlist_clear(ctx->drivers);
-
-    DMOD_LOG_INFO("Unconfigured all drivers\n");
+    // Apply the whole list in one call if the driver supports it. `applied`
+    // stays at the sentinel when the driver does not know the batch command.
+    file_handle_t* handle = (file_handle_t*)fp;
+    int res = flush_write_buffer(ctx, handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+    dmdevfs_ioctl_batch_t batch = { commands, count, (size_t)-1 };
+    int result = 0;
+    res = driver_ioctl(handle, DMDEVFS_IOCTL_BATCH, &batch, &result);
+    if(res == DMFSI_OK && batch.applied != (size_t)-1)
+    {
+        if(batch.applied > count)
+        {
+            batch.applied = count;
+        }
+        if(applied) *applied = batch.applied;
+        return (result == 0 && batch.applied == count) ? DMFSI_OK : DMFSI_ERR_GENERAL;
+    }
+    if(res != DMFSI_OK && res != DMFSI_ERR_NOT_FOUND)
+    {
+        return res;
+    }
 
+    for(size_t i = 0; i < count; i++)
+    {
+        res = driver_ioctl(handle, commands[i].command, commands[i].arg, &commands[i].result);
+        if(res != DMFSI_OK)
+        {
+            DMOD_LOG_ERROR("Driver does not implement dmdrvi_ioctl: %s\n", handle->path);
+            return res;
+        }
+        if(applied) *applied = i + 1;
+        if(commands[i].result != 0)
+        {
+            return DMFSI_ERR_GENERAL;
+        }
+    }
     return DMFSI_OK;
 }
 
 /**
- * @brief Check if a path is a file
+ * @brief Write buffered data of the files of a mount that is due
+ * 
+ * A file is written when it has more than `dirty_bytes` buffered, when its
+ * oldest buffered byte is older than `dirty_age_ms`, or when the mount has
+ * more than DMDEVFS_DIRTY_LIMIT bytes buffered in total.
  */
-static bool is_file(const char* path)
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _writeback, (dmfsi_context_t ctx, int* next_ms) )
 {
-    // Check if path exists
-    if (Dmod_Access(path, DMOD_F_OK) != 0)
+    DMDEVFS_TRACE(writeback, ctx, next_ms);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
     {
-        return false;
+        DMOD_LOG_ERROR("Invalid context in writeback\n");
+        return DMFSI_ERR_INVALID;
     }
-    
-    // Try to open as directory - if it succeeds, it's a directory, not a file
-    void* dir_handle = Dmod_OpenDir(path);
-    if (dir_handle != NULL)
+
+    uint64_t now = Dmod_GetTimeMs();
+    bool over_limit = ctx->dirty_bytes > DMDEVFS_DIRTY_LIMIT;
+    int next = -1;
+    file_handle_t* handle = ctx->dirty_files;
+    while(handle != NULL)
     {
-        Dmod_CloseDir(dir_handle);
-        return false;  // It's a directory
+        file_handle_t* next_handle = handle->next_dirty;
+        const writeback_config_t* config = &handle->driver->write_back;
+        uint64_t age = now - handle->dirty_since;
+        if(over_limit || handle->dirty_length >= config->dirty_bytes || age >= config->dirty_age_ms)
+        {
+            // Errors are kept in the file for the application. Data the
+            // device did not accept yet is retried after the age limit.
+            if(flush_write_buffer(ctx, handle) != DMFSI_OK && handle->dirty_length > 0 &&
+               (next < 0 || (int)config->dirty_age_ms < next))
+            {
+                next = (int)config->dirty_age_ms;
+            }
+        }
+        else
+        {
+            int remaining = (int)(config->dirty_age_ms - age);
+            if(next < 0 || remaining < next)
+            {
+                next = remaining;
+            }
+        }
+        handle = next_handle;
     }
-    
-    return true;  // It's a file
+
+    if(next_ms) *next_ms = next;
+    return DMFSI_OK;
 }
 
 /**
- * @brief Check if a path is a directory
+ * @brief Allocate a buffer meeting the alignment of the device of a file
  */
-static bool is_driver( const char* name)
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, void*, _buffer_alloc, (dmfsi_context_t ctx, void* fp, size_t size) )
 {
-    char module_name[DMOD_MAX_MODULE_NAME_LENGTH] = {0};
-    return Dmod_FindMatch(name, module_name, sizeof(module_name));
-}
+    DMDEVFS_TRACE(buffer_alloc, ctx, fp, size);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in buffer_alloc\n");
+        return NULL;
+    }
+
+    if(fp == NULL || size == 0)
+    {
+        return NULL;
+    }
+
+    file_handle_t* handle = (file_handle_t*)fp;
+    return pool_lend(&handle->driver->pool, size);
+}
+
+/**
+ * @brief Release a buffer from dmdevfs_buffer_alloc()
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _buffer_free, (dmfsi_context_t ctx, void* fp, void* buffer) )
+{
+    DMDEVFS_TRACE(buffer_free, ctx, fp, buffer);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in buffer_free\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(fp == NULL || buffer == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    file_handle_t* handle = (file_handle_t*)fp;
+    if(!pool_reclaim(&handle->driver->pool, buffer))
+    {
+        DMOD_LOG_ERROR("Buffer %p was not allocated for this device or is already released\n", buffer);
+        return DMFSI_ERR_INVALID;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get the I/O capabilities of the device of an open file
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _get_caps, (dmfsi_context_t ctx, void* fp, dmdevfs_caps_t* caps) )
+{
+    DMDEVFS_TRACE(get_caps, ctx, fp, caps);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in get_caps\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(fp == NULL || caps == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    driver_node_t* node = ((file_handle_t*)fp)->driver;
+    if(!node->caps_ready)
+    {
+        build_caps(node);
+    }
+    *caps = node->caps;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Select the write mode of an open file
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _set_write_mode, (dmfsi_context_t ctx, void* fp, int mode) )
+{
+    DMDEVFS_TRACE(set_write_mode, ctx, fp, mode);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in set_write_mode\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(fp == NULL || (mode != DMDEVFS_WRITE_DIRECT && mode != DMDEVFS_WRITE_DIFFERENTIAL))
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    // Buffered data is written in the mode it was written in
+    file_handle_t* handle = (file_handle_t*)fp;
+    int res = flush_write_buffer(ctx, handle);
+    if(res != DMFSI_OK)
+    {
+        return take_flush_error(handle, res);
+    }
+    return set_write_mode(handle, mode);
+}
+
+/**
+ * @brief Tell dmdevfs how an open file is going to be accessed
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _advise, (dmfsi_context_t ctx, void* fp, size_t offset, size_t length, int advice) )
+{
+    DMDEVFS_TRACE(advise, ctx, fp, offset, length, advice);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in advise\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(fp == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    file_handle_t* handle = (file_handle_t*)fp;
+    const driver_node_t* node = handle->driver;
+    size_t end = (length == 0 || offset + length < offset) ? SIZE_MAX : offset + length;
+    switch(advice)
+    {
+        case DMDEVFS_ADVICE_NORMAL:
+            handle->noreuse = false;
+            return set_readahead(handle, node->readahead);
+        case DMDEVFS_ADVICE_SEQUENTIAL:
+            return set_readahead(handle, (node->readahead > 0) ? 2 * node->readahead : DMDEVFS_READAHEAD_SIZE);
+        case DMDEVFS_ADVICE_RANDOM:
+            return set_readahead(handle, 0);
+        case DMDEVFS_ADVICE_WILLNEED:
+            return prefetch(handle, offset, end);
+        case DMDEVFS_ADVICE_DONTNEED:
+            return evict(handle, offset, end);
+        case DMDEVFS_ADVICE_NOREUSE:
+            handle->noreuse = true;
+            return DMFSI_OK;
+        default:
+            return DMFSI_ERR_INVALID;
+    }
+}
+
+/**
+ * @brief Get the I/O capabilities of a device by its path
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _get_path_caps, (dmfsi_context_t ctx, const char* path, dmdevfs_caps_t* caps) )
+{
+    DMDEVFS_TRACE(get_path_caps, ctx, path, caps);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in get_path_caps\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(caps == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    canonical_path_t canonical;
+    driver_node_t* node = NULL;
+    if(canonicalize_path(path, &canonical) == DMFSI_OK)
+    {
+        node = find_driver_node(ctx, &canonical);
+    }
+    if(node == NULL)
+    {
+        DMOD_LOG_ERROR("File not found: %s\n", path ? path : "(null)");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    if(!node->caps_ready)
+    {
+        build_caps(node);
+    }
+    *caps = node->caps;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get the statistics of a device by its path
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _get_stats, (dmfsi_context_t ctx, const char* path, dmdevfs_stats_t* stats) )
+{
+    DMDEVFS_TRACE(get_stats, ctx, path, stats);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in get_stats\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(stats == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    canonical_path_t canonical;
+    driver_node_t* node = NULL;
+    if(canonicalize_path(path, &canonical) == DMFSI_OK)
+    {
+        node = find_driver_node(ctx, &canonical);
+    }
+    if(node == NULL)
+    {
+        DMOD_LOG_ERROR("File not found: %s\n", path ? path : "(null)");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    memset(stats, 0, sizeof(dmdevfs_stats_t));
+    call_watch_t* watch = &node->calls;
+    driver_call_t slow[DMDEVFS_WATCHED_CALLS];
+    size_t slow_count = 0;
+    uint64_t now = Dmod_GetTimeMs();
+
+    Dmod_EnterCritical();
+    if(watch->threshold_ms > 0)
+    {
+        slow_count = take_slow_calls(watch, now, slow);
+        for(size_t i = 0; i < DMDEVFS_WATCHED_CALLS; i++)
+        {
+            const driver_call_t* call = &watch->calls[i];
+            if(call->op == DMDEVFS_OP_NONE)
+            {
+                continue;
+            }
+            uint32_t running_ms = (uint32_t)(now - call->start);
+            if(stats->in_flight == 0 || running_ms > stats->in_flight_ms)
+            {
+                stats->in_flight_op = call->op;
+                stats->in_flight_ms = running_ms;
+            }
+            stats->in_flight++;
+        }
+    }
+    stats->slow_call_ms = watch->threshold_ms;
+    stats->slow_calls = watch->slow_calls;
+    stats->last_slow_op = watch->last_slow_op;
+    stats->last_slow_ms = watch->last_slow_ms;
+    stats->max_call_ms = watch->max_ms;
+    Dmod_ExitCritical();
+
+    for(size_t i = 0; i < slow_count; i++)
+    {
+        report_slow_call(node, slow[i].op, (uint32_t)(now - slow[i].start), false);
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Tag an open file for the accounting of its I/O
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _set_tag, (dmfsi_context_t ctx, void* fp, const char* tag) )
+{
+    DMDEVFS_TRACE(set_tag, ctx, fp, tag);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in set_tag\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(fp == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+    if(tag == NULL)
+    {
+        tag = "";
+    }
+    if(strlen(tag) >= DMOD_MAX_MODULE_NAME_LENGTH)
+    {
+        DMOD_LOG_ERROR("Tag too long: %s\n", tag);
+        return DMFSI_ERR_INVALID;
+    }
+
+    file_handle_t* handle = (file_handle_t*)fp;
+    tag_account_t* account = get_tag_account(handle->driver, tag);
+    if(account == NULL)
+    {
+        return DMFSI_ERR_NO_SPACE;
+    }
+    if(handle->account != NULL)
+    {
+        handle->account->stats.files--;
+    }
+    handle->account = account;
+    account->stats.files++;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get the I/O of the files of a device with one tag
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _get_tag_stats, (dmfsi_context_t ctx, const char* path, size_t index, dmdevfs_tag_stats_t* stats) )
+{
+    DMDEVFS_TRACE(get_tag_stats, ctx, path, index, stats);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in get_tag_stats\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(stats == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    canonical_path_t canonical;
+    driver_node_t* node = NULL;
+    if(canonicalize_path(path, &canonical) == DMFSI_OK)
+    {
+        node = find_driver_node(ctx, &canonical);
+    }
+    if(node == NULL)
+    {
+        DMOD_LOG_ERROR("File not found: %s\n", path ? path : "(null)");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    const tag_account_t* account = node->accounts;
+    for(size_t i = 0; account != NULL && i < index; i++)
+    {
+        account = account->next;
+    }
+    if(account == NULL)
+    {
+        // No more tags
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    *stats = account->stats;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Get the sampled access pattern of a device
+ */
+DMOD_INPUT_API_DECLARATION( dmdevfs, 1.0, int, _get_access_stats, (dmfsi_context_t ctx, const char* path, dmdevfs_access_stats_t* stats, uint32_t* reads, uint32_t* writes, size_t count) )
+{
+    DMDEVFS_TRACE(get_access_stats, ctx, path, stats, count);
+    if(dmfsi_dmdevfs_context_is_valid(ctx) == 0)
+    {
+        DMOD_LOG_ERROR("Invalid context in get_access_stats\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    if(stats == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    canonical_path_t canonical;
+    driver_node_t* node = NULL;
+    if(canonicalize_path(path, &canonical) == DMFSI_OK)
+    {
+        node = find_driver_node(ctx, &canonical);
+    }
+    if(node == NULL)
+    {
+        DMOD_LOG_ERROR("File not found: %s\n", path ? path : "(null)");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    const access_stats_t* access = node->access;
+    if(access == NULL)
+    {
+        DMOD_LOG_ERROR("Access statistics not recorded for: %s\n", path);
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    stats->sample = access->sample;
+    stats->sampled = access->sampled;
+    stats->bucket_size = access->bucket_size;
+    stats->bucket_count = access->bucket_count;
+    memcpy(stats->read_sizes, access->read_sizes, sizeof(stats->read_sizes));
+    memcpy(stats->write_sizes, access->write_sizes, sizeof(stats->write_sizes));
+
+    size_t copied = (count < access->bucket_count) ? count : access->bucket_count;
+    if(reads != NULL)
+    {
+        memcpy(reads, access->reads, copied * sizeof(uint32_t));
+    }
+    if(writes != NULL)
+    {
+        memcpy(writes, access->writes, copied * sizeof(uint32_t));
+    }
+    return DMFSI_OK;
+}
+
+// ============================================================================
+//                      Local functions
+// ============================================================================
+
+/**
+ * @brief Get the driver set for a configuration path
+ * 
+ * Returns the set already configured by another mount of the same path, or
+ * configures a new one. Every call must be paired with release_driver_set().
+ * The registry of sets is only touched inside critical sections, while the
+ * drivers are configured outside of them. A new set is registered before its
+ * drivers are configured, so the drivers of one path are never configured
+ * twice; a mount of the same path made meanwhile fails instead.
+ */
+static driver_set_t* acquire_driver_set(const char* config_path)
+{
+    uint32_t mounts = 0;
+    Dmod_EnterCritical();
+    driver_set_t* set = share_driver_set(config_path, &mounts);
+    Dmod_ExitCritical();
+    if (set != NULL)
+    {
+        return use_shared_set(set, config_path, mounts);
+    }
+
+    set = create_driver_set(config_path);
+    if (set == NULL)
+    {
+        return NULL;
+    }
+
+    bool registered = false;
+    Dmod_EnterCritical();
+    driver_set_t* shared = share_driver_set(config_path, &mounts);
+    if (shared == NULL)
+    {
+        registered = register_driver_set(set);
+    }
+    Dmod_ExitCritical();
+
+    if (!registered)
+    {
+        destroy_driver_set(set);
+        if (shared == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to register drivers of: %s\n", config_path);
+            return NULL;
+        }
+        return use_shared_set(shared, config_path, mounts);
+    }
+
+    if (configure_drivers(set, config_path) != DMFSI_OK ||
+        build_path_indexes(set) != DMFSI_OK)
+    {
+        release_driver_set(set);
+        return NULL;
+    }
+
+    Dmod_EnterCritical();
+    set->ready = true;
+    Dmod_ExitCritical();
+    return set;
+}
+
+/**
+ * @brief Release a driver set acquired with acquire_driver_set()
+ * 
+ * The drivers are unconfigured when the last mount releases the set.
+ */
+static void release_driver_set(driver_set_t* set)
+{
+    if (set == NULL)
+    {
+        return;
+    }
+
+    Dmod_EnterCritical();
+    bool last = (--set->ref_count == 0);
+    if (last)
+    {
+        dmlist_remove(driver_sets, set, compare_same_item);
+        if (dmlist_size(driver_sets) == 0)
+        {
+            dmlist_destroy(driver_sets);
+            driver_sets = NULL;
+        }
+    }
+    Dmod_ExitCritical();
+
+    if (last)
+    {
+        destroy_driver_set(set);
+    }
+}
+
+/**
+ * @brief Take a reference to the registered driver set of a configuration path
+ * 
+ * Must be called inside a critical section. A set whose drivers are still
+ * being configured by another mount is returned without a reference, with
+ * @p mounts set to 0.
+ * 
+ * @param config_path Configuration path of the set
+ * @param mounts Receives the number of mounts using the set
+ * 
+ * @return Registered set, or NULL if there is none for the path
+ */
+static driver_set_t* share_driver_set(const char* config_path, uint32_t* mounts)
+{
+    driver_set_t* set = (driver_sets != NULL) ? dmlist_find(driver_sets, config_path, compare_driver_set_path) : NULL;
+    *mounts = 0;
+    if (set != NULL && set->ready)
+    {
+        *mounts = ++set->ref_count;
+    }
+    return set;
+}
+
+/**
+ * @brief Use a driver set found by share_driver_set() for a new mount
+ * 
+ * @return The set, or NULL if its drivers are still being configured
+ */
+static driver_set_t* use_shared_set(driver_set_t* set, const char* config_path, uint32_t mounts)
+{
+    if (mounts == 0)
+    {
+        DMOD_LOG_ERROR("Drivers of %s are being configured by another mount\n", config_path);
+        return NULL;
+    }
+    DMOD_LOG_INFO("Sharing drivers of: %s (mounts: %u)\n", config_path, mounts);
+    return set;
+}
+
+/**
+ * @brief Add a new driver set to the registry
+ * 
+ * Must be called inside a critical section.
+ * 
+ * @return true if the set was added
+ */
+static bool register_driver_set(driver_set_t* set)
+{
+    if (driver_sets == NULL)
+    {
+        driver_sets = dmlist_create(DMOD_MODULE_NAME);
+        if (driver_sets == NULL)
+        {
+            return false;
+        }
+    }
+
+    if (!dmlist_push_back(driver_sets, set))
+    {
+        if (dmlist_size(driver_sets) == 0)
+        {
+            dmlist_destroy(driver_sets);
+            driver_sets = NULL;
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Create an empty driver set for a configuration path
+ * 
+ * The set has a single reference and no drivers yet.
+ */
+static driver_set_t* create_driver_set(const char* config_path)
+{
+    driver_set_t* set = Dmod_Malloc(sizeof(driver_set_t));
+    if (set == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for driver set\n");
+        return NULL;
+    }
+    set->ref_count = 1;
+    set->ready = false;
+    set->node_index = NULL;
+    set->directory_index = NULL;
+    set->index_mask = 0;
+    set->config_path = Dmod_StrDup(config_path);
+    set->drivers = dmlist_create(DMOD_MODULE_NAME);
+    if (set->config_path == NULL || set->drivers == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for driver set\n");
+        destroy_driver_set(set);
+        return NULL;
+    }
+    return set;
+}
+
+/**
+ * @brief Unconfigure the drivers of a set and free it
+ */
+static void destroy_driver_set(driver_set_t* set)
+{
+    free_path_indexes(set);
+    if (set->drivers != NULL && dmlist_size(set->drivers) > 0)
+    {
+        unconfigure_drivers(set);
+    }
+    if (set->drivers != NULL)       dmlist_destroy(set->drivers);
+    if (set->config_path != NULL)   Dmod_Free(set->config_path);
+    Dmod_Free(set);
+}
+
+/**
+ * @brief Compare the configuration path of a driver set with a given path
+ */
+static int compare_driver_set_path( const void* data, const void* user_data )
+{
+    const driver_set_t* set = (const driver_set_t*)data;
+    const char* path = (const char*)user_data;
+    if (set == NULL || path == NULL)
+    {
+        return -1;
+    }
+
+    return compare_paths_ignore_trailing_slash(set->config_path, path);
+}
+
+/**
+ * @brief Match the list item given as user data
+ */
+static int compare_same_item( const void* data, const void* user_data )
+{
+    return (data == user_data) ? 0 : 1;
+}
+
+/**
+ * @brief Match every list item, to walk a list with dmlist_find_next()
+ */
+static int match_any_item( const void* data, const void* user_data )
+{
+    (void)data;
+    (void)user_data;
+    return 0;
+}
+
+/**
+ * @brief Configure drivers based on the configuration directory tree
+ * 
+ * The tree is walked iteratively with a heap-allocated queue of directories,
+ * so the stack usage does not depend on the depth of the hierarchy.
+ */
+static int configure_drivers(driver_set_t* set, const char* config_path)
+{
+    dmlist_context_t* pending = dmlist_create(DMOD_MODULE_NAME);
+    if (pending == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to create config directory queue\n");
+        return DMFSI_ERR_GENERAL;
+    }
+
+    int result = queue_config_dir(pending, config_path, "");
+    config_dir_t* config_dir;
+    bool is_root = true;
+    while (result == DMFSI_OK && (config_dir = dmlist_pop_front(pending)) != NULL)
+    {
+        int res = configure_directory(set, config_dir, pending);
+        if (res != DMFSI_OK)
+        {
+            if (is_root)
+            {
+                result = res;
+            }
+            else
+            {
+                DMOD_LOG_ERROR("Failed to configure drivers in directory: %s\n", config_dir->path);
+            }
+        }
+        is_root = false;
+        Dmod_Free(config_dir);
+    }
+
+    // Left over only when the walk was aborted
+    while ((config_dir = dmlist_pop_front(pending)) != NULL)
+    {
+        Dmod_Free(config_dir);
+    }
+    dmlist_destroy(pending);
+    return result;
+}
+
+/**
+ * @brief Add a configuration directory to the queue of directories to scan
+ */
+static int queue_config_dir(dmlist_context_t* pending, const char* path, const char* driver_name)
+{
+    if (strlen(path) >= sizeof(path_t))
+    {
+        DMOD_LOG_ERROR("Config directory path too long: %s\n", path);
+        return DMFSI_ERR_INVALID;
+    }
+    if (strlen(driver_name) >= DMOD_MAX_MODULE_NAME_LENGTH)
+    {
+        DMOD_LOG_ERROR("Driver name too long for config directory: %s\n", path);
+        return DMFSI_ERR_INVALID;
+    }
+
+    config_dir_t* config_dir = Dmod_Malloc(sizeof(config_dir_t));
+    if (config_dir == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for config directory: %s\n", path);
+        return DMFSI_ERR_GENERAL;
+    }
+    strncpy(config_dir->path, path, sizeof(config_dir->path));
+    strncpy(config_dir->driver_name, driver_name, sizeof(config_dir->driver_name));
+
+    if (!dmlist_push_back(pending, config_dir))
+    {
+        DMOD_LOG_ERROR("Failed to queue config directory: %s\n", path);
+        Dmod_Free(config_dir);
+        return DMFSI_ERR_GENERAL;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Configure the drivers of a single configuration directory
+ * 
+ * Subdirectories are not entered, but added to the queue of pending directories.
+ */
+static int configure_directory(driver_set_t* set, const config_dir_t* config_dir, dmlist_context_t* pending)
+{
+    const char* config_path = config_dir->path;
+    const char* driver_name = (config_dir->driver_name[0] != '\0') ? config_dir->driver_name : NULL;
+    void* dir = Dmod_OpenDir(config_path);
+    if (dir == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to open config directory: %s\n", config_path);
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    const char* entry;
+    while ((entry = Dmod_ReadDir(dir)) != NULL)
+    {
+        // Construct full path for the entry
+        char full_path[MAX_PATH_LENGTH];
+        size_t config_path_len = strlen(config_path);
+        size_t entry_len = strlen(entry);
+        
+        // Check if we need a separator
+        bool needs_separator = (config_path_len > 0 && config_path[config_path_len - 1] != '/');
+        size_t required_len = config_path_len + (needs_separator ? 1 : 0) + entry_len + 1;
+        
+        if (required_len > MAX_PATH_LENGTH)
+        {
+            DMOD_LOG_ERROR("Path too long: %s/%s\n", config_path, entry);
+            continue;
+        }
+        
+        Dmod_SnPrintf(full_path, sizeof(full_path), "%s%s%s", 
+                      config_path, 
+                      needs_separator ? "/" : "", 
+                      entry);
+        
+        char module_name[DMOD_MAX_MODULE_NAME_LENGTH];
+        if (is_file(full_path))
+        {
+            dmini_context_t config_ctx = read_driver_for_config(full_path, module_name, sizeof(module_name), driver_name);
+            if (config_ctx == NULL)
+            {
+                DMOD_LOG_ERROR("Failed to read driver for config: %s\n", full_path);
+                continue;
+            }
+
+            driver_node_t* driver_node = configure_driver(module_name, config_ctx);
+            bool shadow = read_flag(config_ctx, "shadow");
+            bool children = read_flag(config_ctx, "children");
+            bool access_stats = read_flag(config_ctx, "access_stats");
+            int access_sample = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "access_sample", DMDEVFS_ACCESS_SAMPLE);
+            writeback_config_t write_back;
+            read_writeback_config(config_ctx, &write_back);
+            if (driver_node != NULL)
+            {
+                configure_transfer_size(driver_node, config_ctx);
+                read_caps_config(config_ctx, &driver_node->caps_config);
+                driver_node->caps_ready = false;
+                driver_node->differential = read_flag(config_ctx, "differential");
+                int readahead = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "readahead", 0);
+                driver_node->readahead = (readahead > 0) ? (size_t)readahead : 0;
+            }
+            const char* compression = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "compression", NULL);
+            bool compressed = compression != NULL && strcmp(compression, "lz4") == 0;
+            if (compression != NULL && !compressed)
+            {
+                DMOD_LOG_WARN("Unknown compression '%s' in: %s\n", compression, full_path);
+            }
+            dmini_destroy(config_ctx);
+            if (driver_node == NULL)
+            {
+                DMOD_LOG_ERROR("Failed to configure driver: %s\n", module_name);
+                continue;
+            }
+            driver_node->write_back = write_back;
+            if(!dmlist_push_back(set->drivers, driver_node))
+            {
+                DMOD_LOG_ERROR("Failed to add driver to list: %s\n", module_name);
+                free_driver_node(driver_node);
+                continue;
+            }
+            if (children)
+            {
+                if (publish_children(set, driver_node) > 0)
+                {
+                    // The children are the files, the node only holds their driver context
+                    continue;
+                }
+                DMOD_LOG_WARN("Driver published no children, serving the device itself: %s\n", driver_node->path);
+            }
+            if (shadow && load_shadow(driver_node) != DMFSI_OK)
+            {
+                DMOD_LOG_WARN("Device is not shadowed: %s\n", driver_node->path);
+            }
+            if (compressed && load_image_index(driver_node) != DMFSI_OK)
+            {
+                DMOD_LOG_WARN("Device is served without decompression: %s\n", driver_node->path);
+            }
+            if (access_stats && setup_access_stats(driver_node, access_sample) != DMFSI_OK)
+            {
+                DMOD_LOG_WARN("Access statistics not recorded for: %s\n", driver_node->path);
+            }
+        }
+        else 
+        {
+            // read driver name from directory name
+            read_base_name(entry, module_name, sizeof(module_name));
+            const char* subdir_driver = is_driver(module_name) ? module_name : config_dir->driver_name;
+            if (queue_config_dir(pending, full_path, subdir_driver) != DMFSI_OK)
+            {
+                DMOD_LOG_ERROR("Failed to configure drivers in directory: %s\n", full_path);
+            }
+        }
+    }
+    Dmod_CloseDir(dir);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Configure a single driver based on its name and configuration file
+ */
+static driver_node_t* configure_driver(const char* driver_name, dmini_context_t config_ctx)
+{
+    DMOD_LOG_VERBOSE("Configuring driver: %s\n", driver_name);
+    const char* type = dmini_get_string(config_ctx, "main", "type", NULL);
+    if (type != NULL && strcmp(type, HOSTDEV_TYPE_NAME) == 0)
+    {
+        return configure_hostdev(driver_name, config_ctx);
+    }
+
+    sample_config_t samples;
+    filter_config_t filter;
+    if (read_sample_config(config_ctx, &samples) != DMFSI_OK ||
+        read_filter_config(config_ctx, &samples, &filter) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Invalid sample processing for driver: %s\n", driver_name);
+        return NULL;
+    }
+
+    bool was_loaded = false;
+    bool was_enabled = false;
+    Dmod_Context_t* driver = prepare_driver_module(driver_name, &was_loaded, &was_enabled);
+    if (driver == NULL)
+    {
+        free_filter_config(&filter);
+        return NULL;
+    }
+
+    dmod_dmdrvi_create_t dmdrvi_create = Dmod_GetDifFunction(driver, dmod_dmdrvi_create_sig);
+    if (dmdrvi_create == NULL)
+    {
+        DMOD_LOG_ERROR("Driver module does not implement dmdrvi_create: %s\n", driver_name);
+        cleanup_driver_module(driver_name, was_loaded, was_enabled);
+        free_filter_config(&filter);
+        return NULL;
+    }
+
+    driver_node_t* driver_node = Dmod_Malloc(sizeof(driver_node_t));
+    if (driver_node == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for driver node: %s\n", driver_name);
+        cleanup_driver_module(driver_name, was_loaded, was_enabled);
+        free_filter_config(&filter);
+        return NULL;
+    }
+
+    driver_node->was_loaded = was_loaded;
+    driver_node->was_enabled = was_enabled;
+    driver_node->driver = driver;
+    driver_node->hostdev = NULL;
+    driver_node->shadow = NULL;
+    driver_node->shadow_size = 0;
+    driver_node->image = NULL;
+    driver_node->parent = NULL;
+    driver_node->child_count = 0;
+    driver_node->accounts = NULL;
+    driver_node->access = NULL;
+    read_pool_config(config_ctx, &driver_node->pool);
+    read_completion_config(config_ctx, &driver_node->completion);
+    read_tuning_config(config_ctx, &driver_node->tuning);
+    read_call_watch_config(config_ctx, &driver_node->calls);
+    driver_node->transfer_size = 0;
+    driver_node->transfer_alignment = 1;
+    driver_node->samples = samples;
+    driver_node->filter = filter;
+    DMDEVFS_TRACE(dmdrvi_create_entry, driver_node, config_ctx);
+    driver_node->driver_context = dmdrvi_create(config_ctx, &driver_node->dev_num);
+    DMDEVFS_TRACE(dmdrvi_create_return, driver_node, driver_node->driver_context);
+    if (driver_node->driver_context == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to create driver context: %s\n", driver_name);
+        cleanup_driver_module(driver_name, was_loaded, was_enabled);
+        free_filter_config(&filter);
+        Dmod_Free(driver_node);
+        return NULL;
+    }
+    if(set_node_path( driver_node ) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Failed to read driver node path: %s\n", driver_name);
+        free_driver_node(driver_node);
+        return NULL;
+    }
+
+    DMOD_LOG_INFO("Configured driver: %s (path: %s)\n", driver_name, driver_node->path);
+
+    return driver_node;
+}
+
+/**
+ * @brief Configure a node backed by a Linux host device
+ * 
+ * Example:
+ * [main]
+ * type = hostdev
+ * path = /dev/pts/3
+ * major = 1        ; optional
+ * minor = 0        ; optional
+ */
+static driver_node_t* configure_hostdev(const char* node_name, dmini_context_t config_ctx)
+{
+#ifdef DMDEVFS_ENABLE_HOSTDEV
+    const char* host_path = dmini_get_string(config_ctx, "main", "path", NULL);
+    if (host_path == NULL)
+    {
+        DMOD_LOG_ERROR("Host device path not given for: %s\n", node_name);
+        return NULL;
+    }
+
+    sample_config_t samples;
+    filter_config_t filter;
+    if (read_sample_config(config_ctx, &samples) != DMFSI_OK ||
+        read_filter_config(config_ctx, &samples, &filter) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Invalid sample processing for host device: %s\n", node_name);
+        return NULL;
+    }
+
+    driver_node_t* driver_node = Dmod_Malloc(sizeof(driver_node_t));
+    if (driver_node == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for driver node: %s\n", node_name);
+        free_filter_config(&filter);
+        return NULL;
+    }
+    memset(driver_node, 0, sizeof(driver_node_t));
+    driver_node->samples = samples;
+    driver_node->filter = filter;
+    read_pool_config(config_ctx, &driver_node->pool);
+    read_completion_config(config_ctx, &driver_node->completion);
+    read_tuning_config(config_ctx, &driver_node->tuning);
+    read_call_watch_config(config_ctx, &driver_node->calls);
+    driver_node->transfer_alignment = 1;
+
+    int major = dmini_get_int(config_ctx, "main", "major", -1);
+    int minor = dmini_get_int(config_ctx, "main", "minor", -1);
+    if (major >= 0)
+    {
+        driver_node->dev_num.major = (uint8_t)major;
+        driver_node->dev_num.flags |= DMDRVI_NUM_MAJOR;
+    }
+    if (minor >= 0)
+    {
+        driver_node->dev_num.minor = (uint8_t)minor;
+        driver_node->dev_num.flags |= DMDRVI_NUM_MINOR;
+    }
+
+    driver_node->hostdev = dmdevfs_hostdev_create(node_name, host_path);
+    if (driver_node->hostdev == NULL)
+    {
+        free_filter_config(&driver_node->filter);
+        Dmod_Free(driver_node);
+        return NULL;
+    }
+    if (set_node_path( driver_node ) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Failed to read driver node path: %s\n", node_name);
+        free_driver_node(driver_node);
+        return NULL;
+    }
+    return driver_node;
+#else
+    (void)node_name;
+    (void)config_ctx;
+    DMOD_LOG_ERROR("Host devices are not supported in this build: %s\n", node_name);
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Release a configured driver node and its driver module
+ */
+static void free_driver_node(driver_node_t* node)
+{
+    free_driver_context(node);
+    release_driver_module(node);
+    destroy_driver_node(node);
+}
+
+/**
+ * @brief Free the memory of a node whose driver is already released
+ */
+static void destroy_driver_node(driver_node_t* node)
+{
+    if (node->shadow != NULL)
+    {
+        Dmod_Free(node->shadow);
+    }
+    free_image_index(node);
+    free_tag_accounts(node);
+    if (node->access != NULL)
+    {
+        Dmod_Free(node->access);
+    }
+    free_buffer_pool(&node->pool);
+    free_filter_config(&node->filter);
+    Dmod_Free(node);
+}
+
+/**
+ * @brief Add the child nodes published by the driver of a node to a driver set
+ * 
+ * Only called for nodes configured with `children = true`, because probing
+ * opens the device. The driver is asked with DMDEVFS_IOCTL_GET_CHILD for the
+ * children one by one, until it fails or leaves the name empty. They share the
+ * driver context of the node and are added after it, so they are released
+ * before it.
+ * 
+ * @return Number of children added
+ */
+static size_t publish_children(driver_set_t* set, driver_node_t* node)
+{
+    file_handle_t handle;
+    if (node->hostdev != NULL || open_internal_handle(node, DMFSI_O_RDONLY, &handle) != DMFSI_OK)
+    {
+        return 0;
+    }
+
+    for (uint32_t index = 0; index < DMDEVFS_MAX_CHILDREN; index++)
+    {
+        dmdevfs_child_t child;
+        memset(&child, 0, sizeof(child));
+        child.index = index;
+        int result = -1;
+        if (driver_ioctl(&handle, DMDEVFS_IOCTL_GET_CHILD, &child, &result) != DMFSI_OK || result != 0)
+        {
+            break;
+        }
+        child.index = index;
+        child.name[sizeof(child.name) - 1] = '\0';
+        if (child.name[0] == '\0')
+        {
+            // Drivers that accept any command without filling in the name end the list too
+            break;
+        }
+
+        driver_node_t* child_node = create_child_node(node, &child);
+        if (child_node == NULL)
+        {
+            continue;
+        }
+        if (!dmlist_push_back(set->drivers, child_node))
+        {
+            DMOD_LOG_ERROR("Failed to add driver to list: %s\n", child_node->path);
+            free_driver_node(child_node);
+            continue;
+        }
+        node->child_count++;
+    }
+    close_internal_handle(&handle);
+
+    if (node->child_count > 0)
+    {
+        DMOD_LOG_INFO("Published %u children of: %s\n", (unsigned)node->child_count, node->path);
+    }
+    return node->child_count;
+}
+
+/**
+ * @brief Create the node of a child published by the driver of a node
+ * 
+ * The child shares the driver context and the module of its parent and takes
+ * over its options, except the shadow and the compressed image, which are
+ * properties of a single device.
+ */
+static driver_node_t* create_child_node(driver_node_t* parent, const dmdevfs_child_t* child)
+{
+    const char* name = child->name;
+    if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+        DMOD_LOG_ERROR("Invalid name of child %u of: %s\n", (unsigned)child->index, parent->path);
+        return NULL;
+    }
+
+    path_t path;
+    canonical_path_t canonical;
+    if (parent->path_length + 1 + strlen(name) >= sizeof(path))
+    {
+        DMOD_LOG_ERROR("Path too long: %s/%s\n", parent->path, name);
+        return NULL;
+    }
+    Dmod_SnPrintf(path, sizeof(path), "%s/%s", parent->path, name);
+    if (canonicalize_path(path, &canonical) != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Invalid path of child: %s\n", path);
+        return NULL;
+    }
+
+    driver_node_t* node = Dmod_Malloc(sizeof(driver_node_t));
+    if (node == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for driver node: %s\n", path);
+        return NULL;
+    }
+    *node = *parent;
+    node->filter.taps = NULL;
+    if (parent->filter.taps != NULL)
+    {
+        node->filter.taps = Dmod_Malloc(parent->filter.taps_count * sizeof(float));
+        if (node->filter.taps == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate memory for driver node: %s\n", path);
+            Dmod_Free(node);
+            return NULL;
+        }
+        memcpy(node->filter.taps, parent->filter.taps, parent->filter.taps_count * sizeof(float));
+    }
+
+    // The module is released by the parent
+    node->was_loaded = true;
+    node->was_enabled = true;
+    node->parent = parent;
+    node->child = *child;
+    node->child_count = 0;
+    node->shadow = NULL;
+    node->shadow_size = 0;
+    node->image = NULL;
+    node->pool.free = NULL;
+    node->pool.free_count = 0;
+    node->pool.lent = NULL;
+    node->pool.lent_count = 0;
+    node->caps_ready = false;
+    uint32_t threshold_ms = parent->calls.threshold_ms;
+    memset(&node->calls, 0, sizeof(node->calls));
+    node->calls.threshold_ms = threshold_ms;
+    node->accounts = NULL;
+    node->access = NULL;
+    store_node_path(node, &canonical);
+    return node;
+}
+
+/**
+ * @brief Free the driver context (or host device) of a node
+ */
+static void free_driver_context(driver_node_t* node)
+{
+    if (node->hostdev != NULL)
+    {
+        dmdevfs_hostdev_destroy(node->hostdev);
+        node->hostdev = NULL;
+        return;
+    }
+    if (node->parent != NULL)
+    {
+        // The context belongs to the parent node
+        node->driver_context = NULL;
+        return;
+    }
+
+    dmod_dmdrvi_free_t dmdrvi_free = Dmod_GetDifFunction(node->driver, dmod_dmdrvi_free_sig);
+    if (dmdrvi_free != NULL)
+    {
+        DMDEVFS_TRACE(dmdrvi_free_entry, node, node->driver_context);
+        dmdrvi_free(node->driver_context);
+        DMDEVFS_TRACE(dmdrvi_free_return, node, 0);
+        DMOD_LOG_INFO("Freed driver context for: %s\n", Dmod_GetName(node->driver));
+    }
+    node->driver_context = NULL;
+}
+
+/**
+ * @brief Disable and unload the driver module of a node if dmdevfs loaded it
+ * 
+ * Only the first node configured for a module has loaded or enabled it, so the
+ * module is released once, and must not be used by other nodes afterwards.
+ */
+static void release_driver_module(driver_node_t* node)
+{
+    if (node->driver != NULL && (!node->was_loaded || !node->was_enabled))
+    {
+        cleanup_driver_module(Dmod_GetName(node->driver), node->was_loaded, node->was_enabled);
+    }
+    node->driver = NULL;
+}
+
+/**
+ * @brief Get the name of a node (driver module or host device name)
+ */
+static const char* get_node_name(const driver_node_t* node)
+{
+    if (node->hostdev != NULL)
+    {
+        return dmdevfs_hostdev_name(node->hostdev);
+    }
+    return Dmod_GetName(node->driver);
+}
+
+/**
+ * @brief Unconfigure and unload all drivers
+ */
+static int unconfigure_drivers(driver_set_t* set)
+{
+    if (set == NULL || set->drivers == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    // Take the nodes out of the list in one walk
+    size_t count = dmlist_size(set->drivers);
+    driver_node_t** nodes = (count > 0) ? Dmod_Malloc(count * sizeof(driver_node_t*)) : NULL;
+    if (nodes == NULL)
+    {
+        // Keep the nodes in the list and walk it in configuration order instead
+        DMOD_LOG_WARN("Failed to allocate teardown list, releasing drivers in configuration order\n");
+    }
+    for (size_t i = 0; nodes != NULL && i < count; i++)
+    {
+        nodes[i] = dmlist_pop_front(set->drivers);
+    }
+
+    // Free all driver contexts before any module is released, newest first, so
+    // nodes configured later (that may depend on earlier ones) go away first.
+    // Then release every module once and free the nodes.
+    for (int pass = 0; pass < 3; pass++)
+    {
+        driver_node_t* previous = NULL;
+        for (size_t i = 0; i < count; i++)
+        {
+            driver_node_t* driver_node;
+            if (nodes != NULL)
+            {
+                driver_node = nodes[count - 1 - i];
+            }
+            else if (pass < 2)
+            {
+                driver_node = dmlist_find_next(set->drivers, previous, NULL, match_any_item);
+                previous = driver_node;
+            }
+            else
+            {
+                driver_node = dmlist_pop_front(set->drivers);
+            }
+
+            if (driver_node == NULL)
+            {
+                continue;
+            }
+            if (pass == 0)
+            {
+                free_driver_context(driver_node);
+            }
+            else if (pass == 1)
+            {
+                release_driver_module(driver_node);
+            }
+            else
+            {
+                destroy_driver_node(driver_node);
+            }
+        }
+    }
+    if (nodes != NULL)
+    {
+        Dmod_Free(nodes);
+    }
+
+    dmlist_clear(set->drivers);
+
+    DMOD_LOG_INFO("Unconfigured all drivers\n");
+
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Check if a path is a file
+ */
+static bool is_file(const char* path)
+{
+    // Check if path exists
+    if (Dmod_Access(path, DMOD_F_OK) != 0)
+    {
+        return false;
+    }
+    
+    // Try to open as directory - if it succeeds, it's a directory, not a file
+    void* dir_handle = Dmod_OpenDir(path);
+    if (dir_handle != NULL)
+    {
+        Dmod_CloseDir(dir_handle);
+        return false;  // It's a directory
+    }
+    
+    return true;  // It's a file
+}
+
+/**
+ * @brief Check if a path is a directory
+ */
+static bool is_driver( const char* name)
+{
+    char module_name[DMOD_MAX_MODULE_NAME_LENGTH] = {0};
+    return Dmod_FindMatch(name, module_name, sizeof(module_name));
+}
+
+/**
+ * @brief Extract base name from a path
+ */
+static void read_base_name(const char* path, char* base_name, size_t name_size)
+{
+    const char* last_slash = strrchr(path, '/');
+    const char* name_start = (last_slash != NULL) ? last_slash + 1 : path;
+    strncpy(base_name, name_start, name_size);
+    base_name[name_size - 1] = '\0';
+}
+
+/**
+ * @brief Extract directory name from a path, handling trailing slashes
+ * @param path Path to extract directory name from (may have trailing slash)
+ * @param dir_name Output buffer for directory name
+ * @param name_size Size of output buffer
+ * 
+ * Examples:
+ * - "dev/" -> "dev"
+ * - "/dev/" -> "dev"
+ * - "dmspiflash0/" -> "dmspiflash0"
+ * - "/" -> "" (root has no name)
+ */
+static void read_dir_name_from_path(const char* path, char* dir_name, size_t name_size)
+{
+    if (path == NULL || dir_name == NULL || name_size == 0)
+    {
+        if (dir_name && name_size > 0)
+        {
+            dir_name[0] = '\0';
+        }
+        return;
+    }
+
+    // Find the length without trailing slashes
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/')
+    {
+        len--;
+    }
+
+    // Special case: if path is just "/", return empty
+    if (len == 1 && path[0] == '/')
+    {
+        dir_name[0] = '\0';
+        return;
+    }
+
+    // Find the last slash before the directory name
+    const char* last_slash = NULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (path[i] == '/')
+        {
+            last_slash = &path[i];
+        }
+    }
+
+    // Extract the directory name
+    const char* name_start = (last_slash != NULL) ? last_slash + 1 : path;
+    size_t name_len = len - (name_start - path);
+    
+    // Use snprintf for safe copying with guaranteed null-termination
+    int written = Dmod_SnPrintf(dir_name, name_size, "%.*s", (int)name_len, name_start);
+    if (written < 0 || (size_t)written >= name_size)
+    {
+        // Truncated, but snprintf ensures null-termination
+        dir_name[name_size - 1] = '\0';
+    }
+}
+
+/**
+ * @brief Read driver name from configuration file
+ */
+static dmini_context_t read_driver_for_config(const char* config_path, char* driver_name, size_t name_size, const char* default_driver)
+{
+    dmini_context_t ctx = dmini_create();
+    if (ctx == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to create INI context\n");
+        return NULL;
+    }
+
+    int res = dmini_parse_file(ctx, config_path);
+    if (res != DMINI_OK)
+    {
+        DMOD_LOG_ERROR("Failed to parse INI file: %s\n", config_path);
+        dmini_destroy(ctx);
+        return NULL;  
+    }
+
+    const char* name = dmini_get_string(ctx, "main", "driver_name", default_driver);
+    if(name != NULL)
+    {
+        strncpy(driver_name, name, name_size);
+        driver_name[name_size - 1] = '\0';
+        return ctx;
+    }
+    
+    read_base_name(config_path, driver_name, name_size);
+
+    // cut the `.ini` extension if present
+    char* ext = strrchr(driver_name, '.');
+    if (ext != NULL && strcmp(ext, ".ini") == 0)
+    {
+        *ext = '\0';
+    }
+    return ctx;
+}
+
+/**
+ * @brief Prepare and load a driver module
+ */
+static Dmod_Context_t* prepare_driver_module(const char* driver_name, bool* was_loaded, bool* was_enabled)
+{
+    *was_loaded = Dmod_IsModuleLoaded(driver_name);
+    *was_enabled = Dmod_IsModuleEnabled(driver_name);
+    Dmod_Context_t* driver = Dmod_LoadModuleByName(driver_name);
+    if (driver == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to load driver module: %s\n", driver_name);
+        return NULL;
+    }
+    if (!*was_enabled && !Dmod_EnableModule(driver_name, true, NULL))
+    {
+        DMOD_LOG_ERROR("Failed to enable driver module: %s\n", driver_name);
+        if(!*was_loaded)
+        {
+            Dmod_UnloadModule(driver_name, false);
+        }
+        return NULL;
+    }
+
+    DMOD_LOG_INFO("Prepared driver module: %s (was_loaded: %d, was_enabled: %d)\n", driver_name, *was_loaded, *was_enabled);
+    return driver;
+}
+
+/**
+ * @brief Cleanup and unload a driver module
+ */
+static void cleanup_driver_module(const char* driver_name, bool was_loaded, bool was_enabled)
+{
+    if(!was_enabled)
+    {
+        Dmod_DisableModule(driver_name, false);
+    }
+    if(!was_loaded)
+    {
+        Dmod_UnloadModule(driver_name, false);
+    }
+}
+
+/**
+ * @brief Read the path associated with a driver directory
+ */
+static int read_driver_parent_directory( const driver_node_t* node, char* path_buffer, size_t buffer_size )
+{
+    if (node == NULL || path_buffer == NULL || buffer_size == 0)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    memset(path_buffer, 0, buffer_size);
+    const char* driver_name = get_node_name( node );
+    if(driver_name == NULL)
+    {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+    bool major_given = (node->dev_num.flags & DMDRVI_NUM_MAJOR) != 0;
+    bool minor_given = (node->dev_num.flags & DMDRVI_NUM_MINOR) != 0;
+    if(major_given && minor_given)
+    {
+        Dmod_SnPrintf(path_buffer, buffer_size, "%s%u/", driver_name, node->dev_num.major);
+    }
+    else if(minor_given)
+    {
+        Dmod_SnPrintf(path_buffer, buffer_size, "%sx/", driver_name);
+    }
+    else 
+    {
+        strncpy(path_buffer, ROOT_DIRECTORY_NAME, buffer_size);
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read the path associated with a driver node
+ */
+static int read_driver_node_path( const driver_node_t* node, char* path_buffer, size_t buffer_size )
+{
+    if (node == NULL || path_buffer == NULL || buffer_size == 0)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+    memset(path_buffer, 0, buffer_size);    
+
+    if(read_driver_parent_directory( node, path_buffer, buffer_size ) != DMFSI_OK)
+    {
+        return DMFSI_ERR_GENERAL;
+    }
+    bool major_given = (node->dev_num.flags & DMDRVI_NUM_MAJOR) != 0;
+    bool minor_given = (node->dev_num.flags & DMDRVI_NUM_MINOR) != 0;
+    size_t current_length = strlen(path_buffer);
+    if(current_length >= buffer_size)
+    {
+        DMOD_LOG_ERROR("Buffer too small for driver path\n");
+        return DMFSI_ERR_NO_SPACE;
+    }
+    path_buffer += current_length;
+    buffer_size -= current_length;
+    if(minor_given)
+    {
+        Dmod_SnPrintf(path_buffer, buffer_size, "%u", node->dev_num.minor);
+    }
+    else 
+    {
+        const char* driver_name = get_node_name( node );
+        if(driver_name == NULL)
+        {
+            return DMFSI_ERR_NOT_FOUND;
+        }
+        if(major_given)
+        {
+            Dmod_SnPrintf(path_buffer, buffer_size, "%s%u", driver_name, node->dev_num.major);
+        }
+        else 
+        {
+            strncpy(path_buffer, driver_name, buffer_size);
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Compare two paths, ignoring trailing slashes
+ * @param path1 First path to compare
+ * @param path2 Second path to compare  
+ * @return 0 if equal, non-zero if different
+ * 
+ * Note: The root path "/" is treated specially and retains its slash.
+ * For example, "/" and "//" are considered equal, but "dir" and "dir/" are also equal.
+ */
+static int compare_paths_ignore_trailing_slash( const char* path1, const char* path2 )
+{
+    // Handle NULL pointers - both NULL is equal, one NULL is different
+    if (path1 == NULL && path2 == NULL)
+    {
+        return 0;
+    }
+    if (path1 == NULL || path2 == NULL)
+    {
+        return 1;
+    }
+
+    // Get lengths
+    size_t len1 = strlen(path1);
+    size_t len2 = strlen(path2);
+    
+    // Remove trailing slashes from both paths for comparison
+    // Keep at least "/" if that's the entire path (len > 1 ensures we keep root "/")
+    while (len1 > 1 && path1[len1 - 1] == '/')
+    {
+        len1--;
+    }
+    while (len2 > 1 && path2[len2 - 1] == '/')
+    {
+        len2--;
+    }
+    
+    // Lengths must match
+    if (len1 != len2)
+    {
+        return 1;
+    }
+    
+    // Content must match
+    return strncmp(path1, path2, len1);
+}
+
+/**
+ * @brief Convert a path to the canonical form in a single pass
+ * 
+ * Leading, trailing and duplicate slashes as well as `.` segments are dropped,
+ * and `..` removes the previous segment (it stops at the root). For example
+ * "/dmspiflash0/1", "dmspiflash0//1" and "dmspiflash0/./1/" all become
+ * "dmspiflash0/1".
+ * 
+ * @return DMFSI_OK on success, DMFSI_ERR_NO_SPACE if the path is too long
+ */
+static int canonicalize_path( const char* path, canonical_path_t* canonical )
+{
+    if (path == NULL || canonical == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    char* output = canonical->path;
+    size_t length = 0;
+    uint32_t hash = PATH_HASH_BASIS;
+    bool removed_segment = false;
+    const char* position = path;
+    while (*position != '\0')
+    {
+        if (*position == '/')
+        {
+            position++;
+            continue;
+        }
+
+        const char* segment = position;
+        while (*position != '/' && *position != '\0')
+        {
+            position++;
+        }
+        size_t segment_length = (size_t)(position - segment);
+        if (segment_length == 1 && segment[0] == '.')
+        {
+            continue;
+        }
+        if (segment_length == 2 && segment[0] == '.' && segment[1] == '.')
+        {
+            while (length > 0 && output[length - 1] != '/')
+            {
+                length--;
+            }
+            length = (length > 0) ? length - 1 : 0;
+            removed_segment = true;
+            continue;
+        }
+
+        size_t separator = (length > 0) ? 1 : 0;
+        if (length + separator + segment_length >= sizeof(canonical->path))
+        {
+            return DMFSI_ERR_NO_SPACE;
+        }
+        if (separator)
+        {
+            output[length++] = '/';
+            hash = (hash ^ '/') * PATH_HASH_PRIME;
+        }
+        for (size_t i = 0; i < segment_length; i++)
+        {
+            output[length++] = segment[i];
+            hash = (hash ^ (uint8_t)segment[i]) * PATH_HASH_PRIME;
+        }
+    }
+    output[length] = '\0';
+
+    canonical->length = length;
+    canonical->hash = removed_segment ? hash_path(output, length) : hash;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Compute the FNV-1a hash of a canonical path
+ */
+static uint32_t hash_path( const char* path, size_t length )
+{
+    uint32_t hash = PATH_HASH_BASIS;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)path[i]) * PATH_HASH_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Set the canonical path of a driver node and of its parent directory
+ */
+static int set_node_path( driver_node_t* node )
+{
+    path_t path;
+    canonical_path_t canonical;
+    if (read_driver_node_path( node, path, sizeof(path) ) != DMFSI_OK ||
+        canonicalize_path( path, &canonical ) != DMFSI_OK ||
+        canonical.length == 0)
+    {
+        return DMFSI_ERR_GENERAL;
+    }
+    store_node_path(node, &canonical);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Store a canonical path in a driver node and find its parent directory
+ */
+static void store_node_path( driver_node_t* node, const canonical_path_t* canonical )
+{
+    memcpy(node->path, canonical->path, canonical->length + 1);
+    node->path_length = canonical->length;
+    node->path_hash = canonical->hash;
+
+    const char* last_slash = strrchr(node->path, '/');
+    node->parent_length = (last_slash != NULL) ? (size_t)(last_slash - node->path) : 0;
+    node->parent_hash = hash_path(node->path, node->parent_length);
+}
+
+/**
+ * @brief Build the tables used to find the nodes and directories of a driver set
+ * 
+ * The tables are sized to at least twice the number of nodes. If several nodes
+ * have the same path, the first configured one is found, as before.
+ */
+static int build_path_indexes( driver_set_t* set )
+{
+    size_t count = dmlist_size(set->drivers);
+    size_t size = 4;
+    while (size < count * 2)
+    {
+        size *= 2;
+    }
+
+    set->node_index = Dmod_Malloc(size * sizeof(driver_node_t*));
+    set->directory_index = Dmod_Malloc(size * sizeof(directory_entry_t));
+    if (set->node_index == NULL || set->directory_index == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate path indexes\n");
+        free_path_indexes(set);
+        return DMFSI_ERR_NO_SPACE;
+    }
+    memset(set->node_index, 0, size * sizeof(driver_node_t*));
+    memset(set->directory_index, 0, size * sizeof(directory_entry_t));
+    set->index_mask = size - 1;
+
+    bool created;
+    add_directory(set, "", 0, &created);
+
+    // Visit every node in order, leaving the list as it is
+    for (driver_node_t* node = dmlist_find_next(set->drivers, NULL, NULL, match_any_item); node != NULL;
+         node = dmlist_find_next(set->drivers, node, NULL, match_any_item))
+    {
+        if (node->child_count > 0)
+        {
+            // Only the directory of its children, added with them
+            continue;
+        }
+
+        size_t i = node->path_hash & set->index_mask;
+        while (set->node_index[i] != NULL)
+        {
+            const driver_node_t* other = set->node_index[i];
+            if (other->path_hash == node->path_hash && strcmp(other->path, node->path) == 0)
+            {
+                DMOD_LOG_ERROR("Duplicate device path: %s\n", node->path);
+                break;
+            }
+            i = (i + 1) & set->index_mask;
+        }
+        if (set->node_index[i] != NULL)
+        {
+            continue;
+        }
+        set->node_index[i] = node;
+
+        // Count the node in its directory, and each new directory in its parent
+        size_t length = node->parent_length;
+        directory_entry_t* directory;
+        do
+        {
+            directory = add_directory(set, node->path, length, &created);
+            directory->child_count++;
+            while (length > 0 && node->path[length - 1] != '/')
+            {
+                length--;
+            }
+            length = (length > 0) ? length - 1 : 0;
+        } while (created && directory->length > 0);
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Free the tables built by build_path_indexes()
+ */
+static void free_path_indexes( driver_set_t* set )
+{
+    if (set->node_index != NULL)
+    {
+        Dmod_Free(set->node_index);
+        set->node_index = NULL;
+    }
+    if (set->directory_index != NULL)
+    {
+        Dmod_Free(set->directory_index);
+        set->directory_index = NULL;
+    }
+}
+
+/**
+ * @brief Find or add a directory given by a prefix of a canonical node path
+ * @param created Set to true if the directory was added
+ */
+static directory_entry_t* add_directory( driver_set_t* set, const char* path, size_t length, bool* created )
+{
+    uint32_t hash = hash_path(path, length);
+    size_t i = hash & set->index_mask;
+    while (set->directory_index[i].path != NULL)
+    {
+        directory_entry_t* directory = &set->directory_index[i];
+        if (directory->hash == hash && directory->length == length && memcmp(directory->path, path, length) == 0)
+        {
+            *created = false;
+            return directory;
+        }
+        i = (i + 1) & set->index_mask;
+    }
+
+    directory_entry_t* directory = &set->directory_index[i];
+    directory->path = path;
+    directory->length = length;
+    directory->hash = hash;
+    directory->child_count = 0;
+    *created = true;
+    return directory;
+}
+
+/**
+ * @brief Compare the path of a driver directory with a given path
+ * 
+ * This function compares the parent directory of a driver node with a given path.
+ * It's used by opendir/readdir to find all driver nodes that belong to a specific directory.
+ * 
+ * @param data Pointer to driver_node_t
+ * @param user_data Pointer to canonical_path_t of the directory
+ * @return 0 if the node's parent matches the given path, non-zero otherwise
+ * 
+ * Example: When listing directory "dmspiflash0", this function finds all nodes
+ * whose parent directory is "dmspiflash0" (e.g., nodes with path "dmspiflash0/1").
+ */
+static int compare_driver_directory( const void* data, const void* user_data )
+{
+    const driver_node_t* node = (const driver_node_t*)data;
+    const canonical_path_t* directory = (const canonical_path_t*)user_data;
+    if (node == NULL || directory == NULL)
+    {
+        return -1;
+    }
+
+    return is_node_in_directory(node, directory) ? 0 : 1;
+}
+
+/**
+ * @brief Check if a node is a direct child of a directory
+ * 
+ * Nodes that publish children are their directory, not a file of their parent.
+ */
+static bool is_node_in_directory( const driver_node_t* node, const canonical_path_t* directory )
+{
+    return node->child_count == 0 &&
+           node->parent_hash == directory->hash &&
+           node->parent_length == directory->length &&
+           memcmp(node->path, directory->path, directory->length) == 0;
+}
+
+/**
+ * @brief Compare a driver node with a given driver node
+ */
+static int compare_driver(const void* data, const void* user_data )
+{
+    const driver_node_t* node = (const driver_node_t*)data;
+    const driver_node_t* target = (const driver_node_t*)user_data;
+    if (node == NULL || target == NULL)
+    {
+        return -1;
+    }
+
+    return (node == target) ? 0 : -1;
+}
+
+/**
+ * @brief Check if a path is a directory
+ */
+static bool is_directory( dmfsi_context_t ctx, const canonical_path_t* path )
+{
+    return find_directory(ctx, path) != NULL;
+}
+
+/**
+ * @brief Find a directory by its canonical path
+ */
+static const directory_entry_t* find_directory( dmfsi_context_t ctx, const canonical_path_t* path )
+{
+    const driver_set_t* set = ctx->driver_set;
+    for (size_t i = path->hash & set->index_mask; set->directory_index[i].path != NULL; i = (i + 1) & set->index_mask)
+    {
+        const directory_entry_t* directory = &set->directory_index[i];
+        if (directory->hash == path->hash && directory->length == path->length &&
+            memcmp(directory->path, path->path, path->length) == 0)
+        {
+            return directory;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get the next driver node in a directory
+ */
+static driver_node_t* get_next_driver_node( dmfsi_context_t ctx, driver_node_t* current, const canonical_path_t* directory )
+{
+    return dmlist_find_next(ctx->drivers, current, directory, compare_driver_directory);
+}
+
+/**
+ * @brief Find a driver node by its canonical path
+ */
+static driver_node_t* find_driver_node( dmfsi_context_t ctx, const canonical_path_t* path )
+{
+    const driver_set_t* set = ctx->driver_set;
+    for (size_t i = path->hash & set->index_mask; set->node_index[i] != NULL; i = (i + 1) & set->index_mask)
+    {
+        const driver_node_t* node = set->node_index[i];
+        if (node->path_hash == path->hash && node->path_length == path->length &&
+            memcmp(node->path, path->path, path->length) == 0)
+        {
+            return set->node_index[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get file statistics from a driver
+ */
+static int driver_stat( driver_node_t* context, const char* path, dmdrvi_stat_t* stat )
+{
+    if (context == NULL || stat == NULL)
+    {
+        return DMFSI_ERR_INVALID;
+    }
+
+    int result;
+    if (context->hostdev != NULL)
+    {
+        memset(stat, 0, sizeof(dmdrvi_stat_t));
+        result = dmdevfs_hostdev_stat(context->hostdev, &stat->size);
+    }
+    else
+    {
+        dmod_dmdrvi_stat_t dmdrvi_stat = Dmod_GetDifFunction(context->driver, dmod_dmdrvi_stat_sig);
+        if (dmdrvi_stat == NULL)
+        {
+            DMOD_LOG_ERROR("Driver module does not implement dmdrvi_stat\n");
+            return DMFSI_ERR_NOT_FOUND;
+        }
+
+        if (context->parent != NULL)
+        {
+            // Children are told apart by their name within the driver context
+            path = context->child.name;
+        }
+        driver_call_t* call = begin_driver_call(context, DMDEVFS_OP_STAT);
+        DMDEVFS_TRACE(dmdrvi_stat_entry, context, path);
+        result = dmdrvi_stat(context->driver_context, path, stat);
+        DMDEVFS_TRACE(dmdrvi_stat_return, context, result);
+        end_driver_call(context, call);
+    }
+    if (result == 0 && context->image != NULL)
+    {
+        // Compressed images are seen in their decoded size
+        stat->size = (uint32_t)context->image->image_size;
+    }
+    return result;
+}
+
+/**
+ * @brief Open a device of a driver node
+ */
+static int driver_open( driver_node_t* node, int mode, void** driver_handle )
+{
+    if (node->hostdev != NULL)
+    {
+        *driver_handle = dmdevfs_hostdev_open(node->hostdev, mode);
+        return (*driver_handle != NULL) ? DMFSI_OK : DMFSI_ERR_GENERAL;
+    }
+
+    dmod_dmdrvi_open_t dmdrvi_open = Dmod_GetDifFunction(node->driver, dmod_dmdrvi_open_sig);
+    if(dmdrvi_open == NULL)
+    {
+        DMOD_LOG_ERROR("Driver does not implement dmdrvi_open\n");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    // Note: dmdrvi_open only takes context and flags, returns device handle
+    driver_call_t* call = begin_driver_call(node, DMDEVFS_OP_OPEN);
+    DMDEVFS_TRACE(dmdrvi_open_entry, node, mode);
+    *driver_handle = dmdrvi_open(node->driver_context, mode);
+    DMDEVFS_TRACE(dmdrvi_open_return, node, *driver_handle);
+    end_driver_call(node, call);
+    if (*driver_handle == NULL)
+    {
+        return DMFSI_ERR_GENERAL;
+    }
+    if (node->parent == NULL)
+    {
+        return DMFSI_OK;
+    }
+
+    // dmdrvi_open has no path, so the handle is bound to the child afterwards
+    dmod_dmdrvi_ioctl_t dmdrvi_ioctl = Dmod_GetDifFunction(node->driver, dmod_dmdrvi_ioctl_sig);
+    dmdevfs_child_t child = node->child;
+    int result = -1;
+    if (dmdrvi_ioctl != NULL)
+    {
+        call = begin_driver_call(node, DMDEVFS_OP_IOCTL);
+        DMDEVFS_TRACE(dmdrvi_ioctl_entry, node, DMDEVFS_IOCTL_OPEN_CHILD);
+        result = dmdrvi_ioctl(node->driver_context, *driver_handle, DMDEVFS_IOCTL_OPEN_CHILD, &child);
+        DMDEVFS_TRACE(dmdrvi_ioctl_return, node, result);
+        end_driver_call(node, call);
+    }
+    if (result != 0)
+    {
+        DMOD_LOG_ERROR("Driver rejected the child: %s\n", node->path);
+        dmod_dmdrvi_close_t dmdrvi_close = Dmod_GetDifFunction(node->driver, dmod_dmdrvi_close_sig);
+        if (dmdrvi_close != NULL)
+        {
+            dmdrvi_close(node->driver_context, *driver_handle);
+        }
+        *driver_handle = NULL;
+        return DMFSI_ERR_GENERAL;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Close the device of an open file
+ */
+static void driver_close( file_handle_t* handle )
+{
+    if (handle->driver_handle == NULL)
+    {
+        return;
+    }
+    if (handle->driver->hostdev != NULL)
+    {
+        dmdevfs_hostdev_close(handle->driver_handle);
+        return;
+    }
+
+    dmod_dmdrvi_close_t dmdrvi_close = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_close_sig);
+    if(dmdrvi_close != NULL)
+    {
+        driver_call_t* call = begin_driver_call(handle->driver, DMDEVFS_OP_CLOSE);
+        DMDEVFS_TRACE(dmdrvi_close_entry, handle->driver, handle->driver_handle);
+        dmdrvi_close(handle->driver->driver_context, handle->driver_handle);
+        DMDEVFS_TRACE(dmdrvi_close_return, handle->driver, 0);
+        end_driver_call(handle->driver, call);
+    }
+}
+
+/**
+ * @brief Read raw data from a driver, from the shadow of the device, or decoded from a compressed image
+ * 
+ * Reads of files with a read-ahead window go through the read-ahead buffer.
+ */
+static int driver_read( file_handle_t* handle, void* buffer, size_t size, size_t* read )
+{
+    const driver_node_t* node = handle->driver;
+    if (node->image != NULL)
+    {
+        return read_image(handle, buffer, size, read);
+    }
+    if (node->shadow != NULL)
+    {
+        size_t available = (handle->position < node->shadow_size) ? node->shadow_size - handle->position : 0;
+        *read = (size < available) ? size : available;
+        memcpy(buffer, node->shadow + handle->position, *read);
+        handle->position += *read;
+        return DMFSI_OK;
+    }
+
+    if (handle->readahead_window > 0 || handle->readahead_length > 0)
+    {
+        return read_ahead(handle, buffer, size, read);
+    }
+
+    int res = device_read(handle, buffer, size, read);
+    handle->position += *read;
+    return res;
+}
+
+/**
+ * @brief Read raw data from the device itself
+ */
+static int device_read( file_handle_t* handle, void* buffer, size_t size, size_t* read )
+{
+    *read = 0;
+    if (handle->driver->hostdev != NULL)
+    {
+        if (handle->driver->completion.busy_poll_rate > 0)
+        {
+            // Let the completion mode decide how to wait for the data
+            wait_completion(handle, DMDEVFS_POLL_IN, -1);
+        }
+        *read = dmdevfs_hostdev_read(handle->driver_handle, buffer, size);
+        handle->device_position += *read;
+        return DMFSI_OK;
+    }
+
+    dmod_dmdrvi_read_t dmdrvi_read = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_read_sig);
+    if(dmdrvi_read == NULL)
+    {
+        DMOD_LOG_ERROR("Driver does not implement dmdrvi_read\n");
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    // dmdrvi_read returns size_t (bytes read), not error code
+    driver_call_t* call = begin_driver_call(handle->driver, DMDEVFS_OP_READ);
+    DMDEVFS_TRACE(dmdrvi_read_entry, handle->driver, size);
+    *read = dmdrvi_read(handle->driver->driver_context, handle->driver_handle, buffer, size);
+    DMDEVFS_TRACE(dmdrvi_read_return, handle->driver, *read);
+    end_driver_call(handle->driver, call);
+    handle->device_position += *read;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Move the driver handle of a shadowed device to the position of the application
+ * 
+ * Drivers that do not support DMDEVFS_IOCTL_SEEK are reopened when moving
+ * backwards and read forward; the data read refreshes the shadow.
+ */
+static int sync_device_position( file_handle_t* handle )
+{
+    driver_node_t* node = handle->driver;
+    if (handle->driver_handle != NULL && handle->device_position == handle->position)
+    {
+        return DMFSI_OK;
+    }
+
+    if (handle->driver_handle != NULL)
+    {
+        dmdevfs_seek_t seek = { (long)handle->position, DMFSI_SEEK_SET, -1 };
+        int result = 0;
+        if (driver_ioctl(handle, DMDEVFS_IOCTL_SEEK, &seek, &result) == DMFSI_OK && result == 0)
+        {
+            handle->device_position = handle->position;
+            return DMFSI_OK;
+        }
+    }
+
+    if (handle->driver_handle == NULL || handle->position < handle->device_position)
+    {
+        if (handle->driver_handle != NULL)
+        {
+            driver_close(handle);
+            handle->driver_handle = NULL;
+        }
+        int res = driver_open(node, handle->mode, &handle->driver_handle);
+        if (res != DMFSI_OK)
+        {
+            DMOD_LOG_ERROR("Failed to reopen device: %s\n", node->path);
+            handle->driver_handle = NULL;
+            return res;
+        }
+        handle->device_position = 0;
+    }
+
+    while (handle->device_position < handle->position)
+    {
+        // The data read lands in the shadow, which ends at the size of the device
+        size_t received = 0;
+        size_t chunk = transfer_chunk(node, handle->device_position, handle->position - handle->device_position);
+        size_t room = (handle->device_position < node->shadow_size) ? node->shadow_size - handle->device_position : 0;
+        if (chunk > room)
+        {
+            chunk = room;
+        }
+        if (chunk == 0)
+        {
+            DMOD_LOG_ERROR("Position %u is past the end of device: %s\n", (unsigned)handle->position, node->path);
+            return DMFSI_ERR_INVALID;
+        }
+        int res = device_read(handle, node->shadow + handle->device_position, chunk, &received);
+        if (res != DMFSI_OK || received == 0)
+        {
+            DMOD_LOG_ERROR("Failed to move to position %u of device: %s\n", (unsigned)handle->position, node->path);
+            return (res != DMFSI_OK) ? res : DMFSI_ERR_GENERAL;
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Write raw data to a driver, skipping unchanged blocks in the differential mode
+ */
+static int driver_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written )
+{
+    if (handle->driver->image != NULL)
+    {
+        DMOD_LOG_ERROR("Compressed image is read-only: %s\n", handle->path);
+        *written = 0;
+        return DMFSI_ERR_INVALID;
+    }
+    int res = drop_readahead(handle);
+    if (res != DMFSI_OK)
+    {
+        *written = 0;
+        return res;
+    }
+    if (handle->differential)
+    {
+        return differential_write(handle, buffer, size, written);
+    }
+    return device_write(handle, buffer, size, written);
+}
+
+/**
+ * @brief Write raw data to the device at the position of the application
+ */
+static int device_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written )
+{
+    *written = 0;
+    driver_node_t* node = handle->driver;
+    if (node->shadow != NULL)
+    {
+        // Write through to the device at the position of the application
+        int res = sync_device_position(handle);
+        if (res != DMFSI_OK)
+        {
+            return res;
+        }
+    }
+
+    if (node->hostdev != NULL)
+    {
+        *written = dmdevfs_hostdev_write(handle->driver_handle, buffer, size);
+    }
+    else
+    {
+        dmod_dmdrvi_write_t dmdrvi_write = Dmod_GetDifFunction(node->driver, dmod_dmdrvi_write_sig);
+        if(dmdrvi_write == NULL)
+        {
+            DMOD_LOG_ERROR("Driver does not implement dmdrvi_write\n");
+            return DMFSI_ERR_NOT_FOUND;
+        }
+
+        // dmdrvi_write returns size_t (bytes written), not error code
+        driver_call_t* call = begin_driver_call(node, DMDEVFS_OP_WRITE);
+        DMDEVFS_TRACE(dmdrvi_write_entry, node, size);
+        *written = dmdrvi_write(node->driver_context, handle->driver_handle, buffer, size);
+        DMDEVFS_TRACE(dmdrvi_write_return, node, *written);
+        end_driver_call(node, call);
+    }
+
+    if (node->shadow != NULL && handle->position < node->shadow_size)
+    {
+        size_t stored = node->shadow_size - handle->position;
+        memcpy(node->shadow + handle->position, buffer, (*written < stored) ? *written : stored);
+    }
+    handle->position += *written;
+    handle->device_position += *written;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Write only the blocks that differ from the contents of the device
+ * 
+ * The data is split at block boundaries of the device. Each block is compared
+ * with the shadow or with the current contents read from the device; equal
+ * blocks are passed over with a seek, so the driver never erases or programs
+ * them.
+ */
+static int differential_write( file_handle_t* handle, const void* buffer, size_t size, size_t* written )
+{
+    *written = 0;
+    const uint8_t* data = buffer;
+    while (*written < size)
+    {
+        size_t chunk = handle->diff_block - handle->position % handle->diff_block;
+        if (chunk > size - *written)
+        {
+            chunk = size - *written;
+        }
+
+        bool equal = false;
+        int res = read_current_block(handle, data + *written, chunk, &equal);
+        if (res != DMFSI_OK)
+        {
+            return res;
+        }
+        if (equal)
+        {
+            handle->position += chunk;
+            *written += chunk;
+            continue;
+        }
+
+        size_t accepted = 0;
+        res = device_write(handle, data + *written, chunk, &accepted);
+        *written += accepted;
+        if (res != DMFSI_OK || accepted < chunk)
+        {
+            return res;
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Compare data with the contents of the device at the position of a file
+ * 
+ * Shadowed devices are compared with the shadow and the driver handle stays
+ * where it is. Other devices are read; the driver handle is left after the
+ * block if it is equal and moved back to its start otherwise.
+ */
+static int read_current_block( file_handle_t* handle, const void* data, size_t size, bool* equal )
+{
+    const driver_node_t* node = handle->driver;
+    if (node->shadow != NULL)
+    {
+        *equal = handle->position + size <= node->shadow_size &&
+                 dmdevfs_compare_bytes(node->shadow + handle->position, data, size) == size;
+        return DMFSI_OK;
+    }
+
+    size_t total = 0;
+    while (total < size)
+    {
+        size_t received = 0;
+        int res = device_read(handle, handle->diff_buffer + total, size - total, &received);
+        if (res != DMFSI_OK)
+        {
+            return res;
+        }
+        if (received == 0)
+        {
+            break;
+        }
+        total += received;
+    }
+    *equal = total == size && dmdevfs_compare_bytes(handle->diff_buffer, data, size) == size;
+    if (*equal)
+    {
+        return DMFSI_OK;
+    }
+
+    dmdevfs_seek_t seek = { (long)handle->position, DMFSI_SEEK_SET, -1 };
+    int result = 0;
+    if (driver_ioctl(handle, DMDEVFS_IOCTL_SEEK, &seek, &result) != DMFSI_OK || result != 0)
+    {
+        DMOD_LOG_ERROR("Failed to return to position %u of device: %s\n", (unsigned)handle->position, node->path);
+        return DMFSI_ERR_GENERAL;
+    }
+    handle->device_position = handle->position;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Switch a file between the direct and the differential write mode
+ * 
+ * The differential mode needs a seekable device. Blocks are erase blocks of
+ * the device, or its preferred transfer size when it has no erase blocks.
+ */
+static int set_write_mode( file_handle_t* handle, int mode )
+{
+    driver_node_t* node = handle->driver;
+    if (handle->diff_buffer != NULL)
+    {
+        pool_put(handle->diff_buffer);
+        handle->diff_buffer = NULL;
+    }
+    handle->differential = false;
+    if (mode == DMDEVFS_WRITE_DIRECT)
+    {
+        return DMFSI_OK;
+    }
+
+    if (!node->caps_ready)
+    {
+        build_caps(node);
+    }
+    if (!(node->caps.flags & DMDEVFS_CAP_SEEKABLE))
+    {
+        DMOD_LOG_ERROR("Differential writes need a seekable device: %s\n", node->path);
+        return DMFSI_ERR_INVALID;
+    }
+
+    size_t block = (node->caps.erase_size > 0) ? node->caps.erase_size :
+                   (node->caps.preferred_size > 0) ? node->caps.preferred_size : DMDEVFS_DIFF_BLOCK_SIZE;
+    if (node->shadow == NULL)
+    {
+        handle->diff_buffer = pool_get(&node->pool, block);
+        if (handle->diff_buffer == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate %u bytes for differential writes\n", (unsigned)block);
+            return DMFSI_ERR_NO_SPACE;
+        }
+    }
+    handle->diff_block = block;
+    handle->differential = true;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Flush the device of an open file
+ */
+static int driver_flush( file_handle_t* handle )
+{
+    int result = 0;
+    if (handle->driver->hostdev != NULL)
+    {
+        result = dmdevfs_hostdev_flush(handle->driver_handle);
+    }
+    else
+    {
+        dmod_dmdrvi_flush_t dmdrvi_flush = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_flush_sig);
+        if(dmdrvi_flush == NULL)
+        {
+            // Flush not supported by driver, return OK
+            return DMFSI_OK;
+        }
+        driver_call_t* call = begin_driver_call(handle->driver, DMDEVFS_OP_FLUSH);
+        DMDEVFS_TRACE(dmdrvi_flush_entry, handle->driver, handle->driver_handle);
+        result = dmdrvi_flush(handle->driver->driver_context, handle->driver_handle);
+        DMDEVFS_TRACE(dmdrvi_flush_return, handle->driver, result);
+        end_driver_call(handle->driver, call);
+    }
+    return (result == 0) ? DMFSI_OK : DMFSI_ERR_GENERAL;
+}
+
+/**
+ * @brief Read the sample conversion options from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * sample_format = s24be
+ * target_format = f32
+ * channels = 4
+ */
+static int read_sample_config( dmini_context_t config_ctx, sample_config_t* config )
+{
+    config->source_format = DMDEVFS_SAMPLE_NONE;
+    config->target_format = DMDEVFS_SAMPLE_NONE;
+    config->channels = 0;
+
+    const char* source = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "sample_format", NULL);
+    if(source == NULL)
+    {
+        return DMFSI_OK;
+    }
+
+    const char* target = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "target_format", "s32");
+    int channels = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "channels", 1);
+
+    config->source_format = dmdevfs_parse_sample_format(source);
+    config->target_format = dmdevfs_parse_sample_format(target);
+    if(config->source_format == DMDEVFS_SAMPLE_NONE)
+    {
+        DMOD_LOG_ERROR("Unknown sample format: %s\n", source);
+        return DMFSI_ERR_INVALID;
+    }
+    if(config->target_format != DMDEVFS_SAMPLE_S32 && config->target_format != DMDEVFS_SAMPLE_F32)
+    {
+        DMOD_LOG_ERROR("Unsupported target format: %s\n", target);
+        return DMFSI_ERR_INVALID;
+    }
+    if(channels <= 0)
+    {
+        DMOD_LOG_ERROR("Invalid number of channels: %d\n", channels);
+        return DMFSI_ERR_INVALID;
+    }
+    config->channels = (size_t)channels;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read the write-back options from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * write_back = 4096
+ * dirty_bytes = 1024
+ * dirty_age_ms = 100
+ */
+static void read_writeback_config( dmini_context_t config_ctx, writeback_config_t* config )
+{
+    int buffer_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "write_back", 0);
+    int dirty_bytes = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "dirty_bytes", buffer_size / 2);
+    int dirty_age_ms = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "dirty_age_ms", DMDEVFS_DIRTY_AGE_MS);
+
+    config->buffer_size = (buffer_size > 0) ? (size_t)buffer_size : 0;
+    config->dirty_bytes = (dirty_bytes > 0 && dirty_bytes < buffer_size) ? (size_t)dirty_bytes : config->buffer_size;
+    config->dirty_age_ms = (dirty_age_ms >= 0) ? (uint32_t)dirty_age_ms : DMDEVFS_DIRTY_AGE_MS;
+}
+
+/**
+ * @brief Read the filter options from the driver configuration
+ * 
+ * A filter without a sample format works on native 32-bit integer samples.
+ * 
+ * Example:
+ * [dmdevfs]
+ * filter = average
+ * decimation = 100
+ * 
+ * [dmdevfs]
+ * filter = fir
+ * fir_taps = 0.25, 0.5, 0.25
+ */
+static int read_filter_config( dmini_context_t config_ctx, sample_config_t* samples, filter_config_t* filter )
+{
+    static const struct
+    {
+        const char* name;
+        filter_type_t type;
+    } filters[] = {
+        { "average",  FILTER_AVERAGE  },
+        { "min",      FILTER_MIN      },
+        { "max",      FILTER_MAX      },
+        { "decimate", FILTER_DECIMATE },
+        { "fir",      FILTER_FIR      },
+    };
+
+    memset(filter, 0, sizeof(filter_config_t));
+    const char* name = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "filter", NULL);
+    if(name == NULL)
+    {
+        return DMFSI_OK;
+    }
+
+    for(size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++)
+    {
+        if(strcmp(filters[i].name, name) == 0)
+        {
+            filter->type = filters[i].type;
+        }
+    }
+    if(filter->type == FILTER_NONE)
+    {
+        DMOD_LOG_ERROR("Unknown filter: %s\n", name);
+        return DMFSI_ERR_INVALID;
+    }
+
+    int decimation = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "decimation", 1);
+    if(decimation <= 0)
+    {
+        DMOD_LOG_ERROR("Invalid decimation: %d\n", decimation);
+        return DMFSI_ERR_INVALID;
+    }
+    filter->decimation = (size_t)decimation;
+
+    if(samples->source_format == DMDEVFS_SAMPLE_NONE)
+    {
+        int channels = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "channels", 1);
+        if(channels <= 0)
+        {
+            DMOD_LOG_ERROR("Invalid number of channels: %d\n", channels);
+            return DMFSI_ERR_INVALID;
+        }
+        samples->source_format = DMDEVFS_SAMPLE_S32;
+        samples->target_format = DMDEVFS_SAMPLE_S32;
+        samples->channels = (size_t)channels;
+    }
+
+    if(filter->type != FILTER_FIR)
+    {
+        return DMFSI_OK;
+    }
+
+    float taps[DMDEVFS_MAX_FIR_TAPS];
+    const char* text = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "fir_taps", "");
+    while(*text != '\0')
+    {
+        if(filter->taps_count >= DMDEVFS_MAX_FIR_TAPS || !parse_float(&text, &taps[filter->taps_count]))
+        {
+            DMOD_LOG_ERROR("Invalid FIR coefficients: %s\n", dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "fir_taps", ""));
+            return DMFSI_ERR_INVALID;
+        }
+        filter->taps_count++;
+    }
+    if(filter->taps_count == 0)
+    {
+        DMOD_LOG_ERROR("FIR filter requires fir_taps\n");
+        return DMFSI_ERR_INVALID;
+    }
+
+    filter->taps = Dmod_Malloc(filter->taps_count * sizeof(float));
+    if(filter->taps == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for FIR coefficients\n");
+        return DMFSI_ERR_GENERAL;
+    }
+    // The history window is kept oldest sample first, so store the taps reversed
+    for(size_t i = 0; i < filter->taps_count; i++)
+    {
+        filter->taps[i] = taps[filter->taps_count - 1 - i];
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Release the memory owned by a filter configuration
+ */
+static void free_filter_config( filter_config_t* filter )
+{
+    if(filter->taps != NULL)
+    {
+        Dmod_Free(filter->taps);
+        filter->taps = NULL;
+    }
+}
+
+/**
+ * @brief Read the buffer options from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * buffer_alignment = 32
+ * buffer_pool = 8
+ */
+static void read_pool_config( dmini_context_t config_ctx, buffer_pool_t* pool )
+{
+    int alignment = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "buffer_alignment", DMDEVFS_BUFFER_ALIGNMENT);
+    int max_free = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "buffer_pool", DMDEVFS_POOL_MAX_FREE);
+    if(alignment <= 0 || (alignment & (alignment - 1)) != 0)
+    {
+        DMOD_LOG_WARN("Invalid buffer alignment %d, using %d\n", alignment, DMDEVFS_BUFFER_ALIGNMENT);
+        alignment = DMDEVFS_BUFFER_ALIGNMENT;
+    }
+
+    // The header in front of the buffer needs pointer alignment
+    pool->alignment = ((size_t)alignment < sizeof(void*)) ? sizeof(void*) : (size_t)alignment;
+    pool->max_free = (max_free > 0) ? (size_t)max_free : 0;
+    pool->free_count = 0;
+    pool->free = NULL;
+    pool->lent_count = 0;
+    pool->lent = NULL;
+}
+
+/**
+ * @brief Read the adaptive completion options from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * busy_poll_rate = 2000
+ * busy_poll_spin_ms = 1
+ * busy_poll_budget = 20
+ */
+static void read_completion_config( dmini_context_t config_ctx, completion_config_t* config )
+{
+    int rate = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "busy_poll_rate", 0);
+    int spin_ms = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "busy_poll_spin_ms", 1);
+    int budget = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "busy_poll_budget", 10);
+
+    config->busy_poll_rate = (rate > 0) ? (uint32_t)rate : 0;
+    config->spin_ms = (spin_ms > 0) ? (uint32_t)spin_ms : 1;
+    config->budget_percent = (budget < 0) ? 0 : (budget > 100) ? 100 : (uint32_t)budget;
+}
+
+/**
+ * @brief Read the buffer sizing options from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * auto_buffer = true
+ * buffer_min = 64
+ * buffer_max = 16384
+ */
+static void read_tuning_config( dmini_context_t config_ctx, tuning_config_t* config )
+{
+    int min_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "buffer_min", 64);
+    int max_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "buffer_max", 16 * 1024);
+
+    config->enabled = read_flag(config_ctx, "auto_buffer");
+    config->min_size = (min_size > 0) ? (size_t)min_size : 1;
+    config->max_size = (max_size > 0 && (size_t)max_size >= config->min_size) ? (size_t)max_size : config->min_size;
+}
+
+/**
+ * @brief Read the slow call threshold from the driver configuration
+ * 
+ * Example:
+ * [dmdevfs]
+ * slow_call_ms = 200      ; 0 - calls are not watched
+ */
+static void read_call_watch_config( dmini_context_t config_ctx, call_watch_t* watch )
+{
+    int threshold_ms = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "slow_call_ms", DMDEVFS_SLOW_CALL_MS);
+
+    memset(watch, 0, sizeof(call_watch_t));
+    watch->threshold_ms = (threshold_ms > 0) ? (uint32_t)threshold_ms : 0;
+}
+
+/**
+ * @brief Start watching a driver call of a node
+ * 
+ * Calls already in progress are checked first, so a stuck call is reported
+ * by the next call to the same node (see the Concurrency section of the README).
+ * 
+ * @return Watched call, or NULL if the call is not watched
+ */
+static driver_call_t* begin_driver_call( driver_node_t* node, int op )
+{
+    call_watch_t* watch = &node->calls;
+    if(watch->threshold_ms == 0)
+    {
+        return NULL;
+    }
+
+    uint64_t now = Dmod_GetTimeMs();
+    driver_call_t slow[DMDEVFS_WATCHED_CALLS];
+    driver_call_t* claimed = NULL;
+
+    Dmod_EnterCritical();
+    size_t slow_count = take_slow_calls(watch, now, slow);
+    for(size_t i = 0; i < DMDEVFS_WATCHED_CALLS; i++)
+    {
+        driver_call_t* call = &watch->calls[i];
+        if(call->op == DMDEVFS_OP_NONE)
+        {
+            call->op = op;
+            call->start = now;
+            call->reported = false;
+            claimed = call;
+            break;
+        }
+    }
+    Dmod_ExitCritical();
+
+    for(size_t i = 0; i < slow_count; i++)
+    {
+        report_slow_call(node, slow[i].op, (uint32_t)(now - slow[i].start), false);
+    }
+    return claimed;
+}
+
+/**
+ * @brief Stop watching a driver call and report it if it was slow
+ */
+static void end_driver_call( driver_node_t* node, driver_call_t* call )
+{
+    if(call == NULL)
+    {
+        return;
+    }
+
+    call_watch_t* watch = &node->calls;
+    uint32_t duration_ms = (uint32_t)(Dmod_GetTimeMs() - call->start);
+    bool reported = false;
+    bool slow = false;
+
+    Dmod_EnterCritical();
+    int op = call->op;
+    if(duration_ms > watch->max_ms)
+    {
+        watch->max_ms = duration_ms;
+    }
+    if(call->reported)
+    {
+        // Already counted while in progress, keep the final duration
+        watch->last_slow_ms = duration_ms;
+        reported = true;
+    }
+    else if(duration_ms >= watch->threshold_ms)
+    {
+        count_slow_call(watch, op, duration_ms);
+        slow = true;
+    }
+    call->op = DMDEVFS_OP_NONE;
+    Dmod_ExitCritical();
+
+    if(reported)
+    {
+        DMOD_LOG_WARN("Slow driver call finished: %s of %s after %u ms\n", get_op_name(op), node->path, (unsigned)duration_ms);
+    }
+    else if(slow)
+    {
+        report_slow_call(node, op, duration_ms, true);
+    }
+}
+
+/**
+ * @brief Count the driver calls of a node that are in progress for longer than the threshold
+ * 
+ * Must be called in a critical section. The calls are copied to @p slow,
+ * to be reported by the caller once the critical section is left.
+ * 
+ * @return Number of calls copied to @p slow (at most DMDEVFS_WATCHED_CALLS)
+ */
+static size_t take_slow_calls( call_watch_t* watch, uint64_t now, driver_call_t* slow )
+{
+    size_t count = 0;
+    for(size_t i = 0; i < DMDEVFS_WATCHED_CALLS; i++)
+    {
+        driver_call_t* call = &watch->calls[i];
+        if(call->op != DMDEVFS_OP_NONE && !call->reported && now - call->start >= watch->threshold_ms)
+        {
+            call->reported = true;
+            count_slow_call(watch, call->op, (uint32_t)(now - call->start));
+            slow[count++] = *call;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Count a slow driver call of a node (in a critical section)
+ */
+static void count_slow_call( call_watch_t* watch, int op, uint32_t duration_ms )
+{
+    watch->slow_calls++;
+    watch->last_slow_op = op;
+    watch->last_slow_ms = duration_ms;
+}
+
+/**
+ * @brief Log a slow driver call of a node
+ * @param finished The call returned (otherwise it is still in progress)
+ */
+static void report_slow_call( driver_node_t* node, int op, uint32_t duration_ms, bool finished )
+{
+    DMDEVFS_TRACE(slow_call, node, op, duration_ms);
+    DMOD_LOG_WARN("Slow driver call: %s of %s %s %u ms\n", get_op_name(op), node->path,
+                  finished ? "took" : "in progress for", (unsigned)duration_ms);
+}
+
+/**
+ * @brief Get the name of a DMDEVFS_OP_* driver call
+ */
+static const char* get_op_name( int op )
+{
+    switch(op)
+    {
+        case DMDEVFS_OP_STAT:   return "dmdrvi_stat";
+        case DMDEVFS_OP_OPEN:   return "dmdrvi_open";
+        case DMDEVFS_OP_CLOSE:  return "dmdrvi_close";
+        case DMDEVFS_OP_READ:   return "dmdrvi_read";
+        case DMDEVFS_OP_WRITE:  return "dmdrvi_write";
+        case DMDEVFS_OP_FLUSH:  return "dmdrvi_flush";
+        case DMDEVFS_OP_IOCTL:  return "dmdrvi_ioctl";
+        default:                return "none";
+    }
+}
+
+/**
+ * @brief Find the I/O account of a tag in a node, or add it
+ * @return Account, or NULL if it cannot be allocated
+ */
+static tag_account_t* get_tag_account( driver_node_t* node, const char* tag )
+{
+    tag_account_t** link = &node->accounts;
+    while(*link != NULL)
+    {
+        if(strcmp((*link)->stats.tag, tag) == 0)
+        {
+            return *link;
+        }
+        link = &(*link)->next;
+    }
+
+    tag_account_t* account = Dmod_Malloc(sizeof(tag_account_t));
+    if(account == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate I/O account of tag '%s' for: %s\n", tag, node->path);
+        return NULL;
+    }
+    memset(account, 0, sizeof(tag_account_t));
+    strncpy(account->stats.tag, tag, sizeof(account->stats.tag) - 1);
+    *link = account;
+    return account;
+}
+
+/**
+ * @brief Free the I/O accounts of a node
+ */
+static void free_tag_accounts( driver_node_t* node )
+{
+    while(node->accounts != NULL)
+    {
+        tag_account_t* account = node->accounts;
+        node->accounts = account->next;
+        Dmod_Free(account);
+    }
+}
+
+/**
+ * @brief Add a read or a write of the application to the account of its file
+ * @param start Time the call started
+ */
+static void account_io( file_handle_t* handle, bool write, size_t bytes, uint64_t start )
+{
+    tag_account_t* account = handle->account;
+    if(account == NULL)
+    {
+        return;
+    }
+
+    dmdevfs_tag_stats_t* stats = &account->stats;
+    uint32_t duration_ms = (uint32_t)(Dmod_GetTimeMs() - start);
+    if(write)
+    {
+        stats->writes++;
+        stats->bytes_written += bytes;
+        stats->write_ms += duration_ms;
+    }
+    else
+    {
+        stats->reads++;
+        stats->bytes_read += bytes;
+        stats->read_ms += duration_ms;
+    }
+    if(duration_ms > stats->max_ms)
+    {
+        stats->max_ms = duration_ms;
+    }
+}
+
+/**
+ * @brief Start recording the access pattern of a seekable device
+ * 
+ * The device is split into buckets of erase blocks (DMDEVFS_ACCESS_BUCKET_SIZE
+ * if it has none), merged in pairs until there are at most
+ * DMDEVFS_ACCESS_MAX_BUCKETS of them.
+ * 
+ * Example:
+ * [dmdevfs]
+ * access_stats = true
+ * access_sample = 8       ; 1 - every request
+ * 
+ * @param sample Requests per recorded request
+ */
+static int setup_access_stats( driver_node_t* node, int sample )
+{
+    if(!node->caps_ready)
+    {
+        build_caps(node);
+    }
+    dmdrvi_stat_t stat = {0};
+    if(!(node->caps.flags & DMDEVFS_CAP_SEEKABLE) || driver_stat(node, node->path, &stat) != 0 || stat.size == 0)
+    {
+        DMOD_LOG_ERROR("Access statistics need a seekable device of a known size: %s\n", node->path);
+        return DMFSI_ERR_INVALID;
+    }
+
+    size_t bucket_size = (node->caps.erase_size > 0) ? node->caps.erase_size : DMDEVFS_ACCESS_BUCKET_SIZE;
+    size_t bucket_count = (stat.size + bucket_size - 1) / bucket_size;
+    while(bucket_count > DMDEVFS_ACCESS_MAX_BUCKETS)
+    {
+        bucket_size *= 2;
+        bucket_count = (stat.size + bucket_size - 1) / bucket_size;
+    }
+
+    access_stats_t* access = Dmod_Malloc(sizeof(access_stats_t) + 2 * bucket_count * sizeof(uint32_t));
+    if(access == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate access statistics for: %s\n", node->path);
+        return DMFSI_ERR_NO_SPACE;
+    }
+    memset(access, 0, sizeof(access_stats_t) + 2 * bucket_count * sizeof(uint32_t));
+    access->sample = (sample > 0) ? (uint32_t)sample : 1;
+    access->countdown = 1;
+    access->bucket_size = bucket_size;
+    access->bucket_count = bucket_count;
+    access->reads = (uint32_t*)(access + 1);
+    access->writes = access->reads + bucket_count;
+    node->access = access;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Record a read or a write of the application in the access pattern of its device
+ * @param offset Position of the file before the request
+ * @param size Requested size
+ * @param transferred Bytes read or written
+ */
+static void record_access( file_handle_t* handle, bool write, size_t offset, size_t size, size_t transferred )
+{
+    access_stats_t* access = handle->driver->access;
+    if(access == NULL || --access->countdown > 0)
+    {
+        return;
+    }
+    access->countdown = access->sample;
+    access->sampled++;
+
+    uint32_t* sizes = write ? access->write_sizes : access->read_sizes;
+    sizes[get_size_class(size)]++;
+    if(transferred == 0)
+    {
+        return;
+    }
+
+    uint32_t* buckets = write ? access->writes : access->reads;
+    size_t first = offset / access->bucket_size;
+    size_t last = (offset + transferred - 1) / access->bucket_size;
+    for(size_t i = first; i <= last && i < access->bucket_count; i++)
+    {
+        buckets[i]++;
+    }
+}
+
+/**
+ * @brief Get the size class of a request (class i - 2^i to 2^(i+1) - 1 bytes)
+ */
+static size_t get_size_class( size_t size )
+{
+    size_t size_class = 0;
+    while(size > 1 && size_class < DMDEVFS_SIZE_CLASSES - 1)
+    {
+        size >>= 1;
+        size_class++;
+    }
+    return size_class;
+}
+
+/**
+ * @brief Record a driver transfer made through a buffer
+ * @param full The transfer was limited by the size of the buffer
+ */
+static void record_transfer( buffer_tuner_t* tuner, size_t bytes, uint64_t busy_ms, bool full )
+{
+    tuner->transfers++;
+    tuner->bytes += bytes;
+    tuner->busy_ms += busy_ms;
+    if(full)
+    {
+        tuner->full++;
+    }
+}
+
+/**
+ * @brief Decide the next size of a buffer from the transfers made through it
+ * 
+ * A buffer that limits most transfers is doubled, as long as the buffers of
+ * all files stay within DMDEVFS_BUFFER_BUDGET. If doubling did not raise the
+ * throughput of the driver, the buffer goes back to its previous size and does
+ * not grow past it again. A buffer that is less than a quarter used is halved,
+ * returning the memory to the pool.
+ * 
+ * @return New size of the buffer (`size` if it stays)
+ */
+static size_t tune_buffer( const tuning_config_t* config, buffer_tuner_t* tuner, size_t size )
+{
+    if(!config->enabled || tuner->transfers < DMDEVFS_TUNE_TRANSFERS)
+    {
+        return size;
+    }
+
+    // Bytes per millisecond in the driver; transfers below the timer resolution
+    // count as fast as possible
+    uint64_t rate = (tuner->busy_ms > 0) ? tuner->bytes / tuner->busy_ms : UINT64_MAX;
+    size_t new_size = size;
+    uint64_t last_rate = tuner->last_rate;
+    tuner->last_rate = 0;
+    if(last_rate > 0 && last_rate != UINT64_MAX && rate < last_rate + last_rate / 10)
+    {
+        tuner->limit = size / 2;
+        new_size = size / 2;
+    }
+    else if(tuner->full * 2 >= tuner->transfers)
+    {
+        size_t max_size = (tuner->limit > 0 && tuner->limit < config->max_size) ? tuner->limit : config->max_size;
+        if(size * 2 <= max_size && get_buffer_bytes() + size <= DMDEVFS_BUFFER_BUDGET)
+        {
+            new_size = size * 2;
+            tuner->last_rate = rate;
+        }
+    }
+    else if(tuner->bytes < (size_t)tuner->transfers * size / 4 && size / 2 >= config->min_size)
+    {
+        new_size = size / 2;
+    }
+
+    tuner->transfers = 0;
+    tuner->full = 0;
+    tuner->bytes = 0;
+    tuner->busy_ms = 0;
+    return new_size;
+}
+
+/**
+ * @brief Account staging or write-back buffers of a file released and taken
+ */
+static void update_buffer_bytes( size_t released, size_t taken )
+{
+    Dmod_EnterCritical();
+    buffer_bytes = buffer_bytes - released + taken;
+    Dmod_ExitCritical();
+}
+
+/**
+ * @brief Get the bytes of the staging and write-back buffers of all open files
+ */
+static size_t get_buffer_bytes( void )
+{
+    Dmod_EnterCritical();
+    size_t bytes = buffer_bytes;
+    Dmod_ExitCritical();
+    return bytes;
+}
+
+/**
+ * @brief Get a buffer of at least `size` bytes from the pool of a node
+ * 
+ * Released buffers are reused first, the smallest one that fits, so
+ * steady-state I/O does not allocate and small requests do not take the
+ * large buffers.
+ */
+static void* pool_get( buffer_pool_t* pool, size_t size )
+{
+    pool_block_t** best = NULL;
+    for(pool_block_t** link = &pool->free; *link != NULL; link = &(*link)->next)
+    {
+        if((*link)->capacity >= size && (best == NULL || (*link)->capacity < (*best)->capacity))
+        {
+            best = link;
+        }
+    }
+    if(best != NULL)
+    {
+        pool_block_t* block = *best;
+        *best = block->next;
+        pool->free_count--;
+        block->next = NULL;
+        return (uint8_t*)block + sizeof(pool_block_t);
+    }
+
+    if(size > SIZE_MAX - sizeof(pool_block_t) - pool->alignment + 1)
+    {
+        DMOD_LOG_ERROR("Buffer of %lu bytes is too large\n", (unsigned long)size);
+        return NULL;
+    }
+    void* base = Dmod_Malloc(size + sizeof(pool_block_t) + pool->alignment - 1);
+    if(base == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate buffer of %u bytes\n", (unsigned)size);
+        return NULL;
+    }
+    uintptr_t data = ((uintptr_t)base + sizeof(pool_block_t) + pool->alignment - 1) & ~(uintptr_t)(pool->alignment - 1);
+    pool_block_t* block = (pool_block_t*)(data - sizeof(pool_block_t));
+    block->next = NULL;
+    block->base = base;
+    block->capacity = size;
+    block->pool = pool;
+    return (void*)data;
+}
+
+/**
+ * @brief Return a buffer from pool_get() to its pool
+ */
+static void pool_put( void* buffer )
+{
+    pool_block_t* block = (pool_block_t*)((uint8_t*)buffer - sizeof(pool_block_t));
+    buffer_pool_t* pool = block->pool;
+    if(pool->free_count >= pool->max_free)
+    {
+        Dmod_Free(block->base);
+        return;
+    }
+    block->next = pool->free;
+    pool->free = block;
+    pool->free_count++;
+}
+
+/**
+ * @brief Get a buffer for an application and keep it on the lent list of the pool
+ */
+static void* pool_lend( buffer_pool_t* pool, size_t size )
+{
+    uint8_t* buffer = pool_get(pool, size);
+    if(buffer == NULL)
+    {
+        return NULL;
+    }
+    pool_block_t* block = (pool_block_t*)(buffer - sizeof(pool_block_t));
+    block->next = pool->lent;
+    pool->lent = block;
+    pool->lent_count++;
+    return buffer;
+}
+
+/**
+ * @brief Return a buffer lent by pool_lend() to its pool
+ * 
+ * The buffer is looked up in the lent list by its address, so pointers that
+ * were not lent by this pool are rejected without being dereferenced.
+ * 
+ * @return true if the buffer was lent by the pool and is released now
+ */
+static bool pool_reclaim( buffer_pool_t* pool, void* buffer )
+{
+    for(pool_block_t** link = &pool->lent; *link != NULL; link = &(*link)->next)
+    {
+        pool_block_t* block = *link;
+        if((uint8_t*)block + sizeof(pool_block_t) == (uint8_t*)buffer)
+        {
+            *link = block->next;
+            pool->lent_count--;
+            block->next = NULL;
+            pool_put(buffer);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Free the released buffers of a pool
+ * 
+ * Buffers still lent to applications are reported and freed as well, so
+ * none of them is left pointing to the released pool.
+ */
+static void free_buffer_pool( buffer_pool_t* pool )
+{
+    if(pool->lent_count > 0)
+    {
+        DMOD_LOG_ERROR("%u buffers from dmdevfs_buffer_alloc were not released\n", (unsigned)pool->lent_count);
+    }
+    while(pool->lent != NULL)
+    {
+        pool_block_t* block = pool->lent;
+        pool->lent = block->next;
+        Dmod_Free(block->base);
+    }
+    pool->lent_count = 0;
+    while(pool->free != NULL)
+    {
+        pool_block_t* block = pool->free;
+        pool->free = block->next;
+        Dmod_Free(block->base);
+    }
+    pool->free_count = 0;
+}
+
+/**
+ * @brief Parse a decimal number from a comma or space separated list
+ * @param text Position in the list, moved past the parsed number and its separator
+ * @param value Parsed number
+ * @return true on success, false if the text is not a number
+ */
+static bool parse_float( const char** text, float* value )
+{
+    const char* cursor = *text;
+    while(*cursor == ' ' || *cursor == '\t')
+    {
+        cursor++;
+    }
+
+    float sign = 1.0f;
+    if(*cursor == '-' || *cursor == '+')
+    {
+        sign = (*cursor == '-') ? -1.0f : 1.0f;
+        cursor++;
+    }
+
+    float result = 0.0f;
+    float scale = 0.0f;
+    bool has_digits = false;
+    for(; (*cursor >= '0' && *cursor <= '9') || *cursor == '.'; cursor++)
+    {
+        if(*cursor == '.')
+        {
+            if(scale != 0.0f)
+            {
+                return false;
+            }
+            scale = 1.0f;
+            continue;
+        }
+        result = result * 10.0f + (float)(*cursor - '0');
+        scale *= 10.0f;
+        has_digits = true;
+    }
+    if(!has_digits)
+    {
+        return false;
+    }
+
+    while(*cursor == ' ' || *cursor == '\t' || *cursor == ',')
+    {
+        cursor++;
+    }
+    *value = sign * ((scale != 0.0f) ? result / scale : result);
+    *text = cursor;
+    return true;
+}
+
+/**
+ * @brief Create the conversion stage of a file handle
+ */
+static convert_stage_t* create_convert_stage( const sample_config_t* config, const filter_config_t* filter, buffer_pool_t* pool, size_t buffer_size )
+{
+    size_t frame_size = dmdevfs_sample_size(config->source_format) * config->channels;
+    size_t frames = buffer_size / frame_size;
+    if(frames == 0)
+    {
+        frames = 1;
+    }
+
+    // The stage, its accumulators and FIR history share one pool buffer
+    size_t accumulators_size = (filter->type != FILTER_NONE) ? config->channels * sizeof(filter_accumulator_t) : 0;
+    size_t history_size = (filter->type == FILTER_FIR) ? config->channels * 2 * filter->taps_count * sizeof(float) : 0;
+    convert_stage_t* stage = pool_get(pool, sizeof(convert_stage_t) + accumulators_size + history_size);
+    if(stage == NULL)
+    {
+        return NULL;
+    }
+    memset(stage, 0, sizeof(convert_stage_t) + accumulators_size + history_size);
+    if(accumulators_size > 0)
+    {
+        stage->accumulators = (filter_accumulator_t*)(stage + 1);
+    }
+    if(history_size > 0)
+    {
+        stage->history = (float*)((uint8_t*)(stage + 1) + accumulators_size);
+    }
+    stage->capacity = frames * frame_size;
+    stage->buffer = pool_get(pool, stage->capacity);
+    if(stage->buffer == NULL)
+    {
+        destroy_convert_stage(stage);
+        return NULL;
+    }
+    update_buffer_bytes(0, stage->capacity);
+
+    if(filter->type != FILTER_NONE)
+    {
+        stage->converted = pool_get(pool, frames * dmdevfs_sample_size(config->target_format) * config->channels);
+        if(stage->converted == NULL)
+        {
+            destroy_convert_stage(stage);
+            return NULL;
+        }
+    }
+    return stage;
+}
+
+/**
+ * @brief Destroy the conversion stage of a file handle
+ */
+static void destroy_convert_stage( convert_stage_t* stage )
+{
+    if(stage != NULL)
+    {
+        if(stage->buffer != NULL)
+        {
+            update_buffer_bytes(stage->capacity, 0);
+            pool_put(stage->buffer);
+        }
+        if(stage->converted != NULL)
+        {
+            pool_put(stage->converted);
+        }
+        pool_put(stage);
+    }
+}
+
+/**
+ * @brief Read whole frames from the driver and convert them into the caller's buffer
+ * 
+ * Only complete frames are returned. Bytes of a frame that the driver delivered
+ * partially are kept in the stage and completed by the next read.
+ */
+static int read_converted( file_handle_t* handle, void* buffer, size_t size, size_t* read )
+{
+    const sample_config_t* config = &handle->driver->samples;
+    const filter_config_t* filter = &handle->driver->filter;
+    convert_stage_t* stage = handle->convert;
+    size_t input_frame = dmdevfs_sample_size(config->source_format) * config->channels;
+    size_t output_frame = dmdevfs_sample_size(config->target_format) * config->channels;
+    size_t frames_left = size / output_frame;
+    uint8_t* output = (uint8_t*)buffer;
+
+    *read = 0;
+    while(frames_left > 0)
+    {
+        // Never read more input than needed for the requested output frames
+        size_t needed = frames_left;
+        if(filter->type != FILTER_NONE)
+        {
+            needed = frames_left * filter->decimation - stage->filter_count;
+        }
+        size_t frames = stage->capacity / input_frame;
+        if(frames > needed)
+        {
+            frames = needed;
+        }
+
+        size_t requested = frames * input_frame - stage->pending;
+        size_t received = 0;
+        bool tuning = handle->driver->tuning.enabled;
+        uint64_t start = tuning ? Dmod_GetTimeMs() : 0;
+        int res = driver_read(handle, stage->buffer + stage->pending, requested, &received);
+        if(res != DMFSI_OK)
+        {
+            return res;
+        }
+        if(tuning)
+        {
+            record_transfer(&stage->tuner, received, Dmod_GetTimeMs() - start, frames < needed);
+        }
+
+        size_t available = stage->pending + received;
+        size_t complete = available / input_frame;
+        size_t produced = complete;
+        if(stage->converted == NULL)
+        {
+            dmdevfs_convert_samples(config->source_format, stage->buffer, config->target_format, output, complete * config->channels);
+        }
+        else
+        {
+            dmdevfs_convert_samples(config->source_format, stage->buffer, config->target_format, stage->converted, complete * config->channels);
+            produced = filter_frames(handle, stage->converted, complete, output);
+        }
+        output += produced * output_frame;
+        *read += produced * output_frame;
+        frames_left -= produced;
+
+        stage->pending = available - complete * input_frame;
+        if(stage->pending > 0)
+        {
+            memmove(stage->buffer, stage->buffer + complete * input_frame, stage->pending);
+        }
+
+        size_t capacity = tune_buffer(&handle->driver->tuning, &stage->tuner, stage->capacity);
+        if(capacity != stage->capacity)
+        {
+            resize_convert_stage(handle, capacity);
+        }
+
+        if(received < requested)
+        {
+            break;  // The driver has no more data for now
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Change the size of the staging buffer of a conversion stage
+ * 
+ * The size is rounded down to whole input frames. Bytes of an incomplete
+ * frame are moved to the new buffer. The stage keeps its buffers if the new
+ * ones cannot be allocated.
+ */
+static void resize_convert_stage( file_handle_t* handle, size_t capacity )
+{
+    const sample_config_t* config = &handle->driver->samples;
+    convert_stage_t* stage = handle->convert;
+    size_t input_frame = dmdevfs_sample_size(config->source_format) * config->channels;
+    size_t frames = capacity / input_frame;
+    if(frames == 0)
+    {
+        frames = 1;
+    }
+    capacity = frames * input_frame;
+    if(capacity == stage->capacity)
+    {
+        return;
+    }
+
+    uint8_t* buffer = pool_get(&handle->driver->pool, capacity);
+    if(buffer == NULL)
+    {
+        return;
+    }
+    if(stage->converted != NULL)
+    {
+        void* converted = pool_get(&handle->driver->pool, frames * dmdevfs_sample_size(config->target_format) * config->channels);
+        if(converted == NULL)
+        {
+            pool_put(buffer);
+            return;
+        }
+        pool_put(stage->converted);
+        stage->converted = converted;
+    }
+
+    memcpy(buffer, stage->buffer, stage->pending);
+    pool_put(stage->buffer);
+    update_buffer_bytes(stage->capacity, capacity);
+    stage->buffer = buffer;
+    stage->capacity = capacity;
+}
+
+/**
+ * @brief Pass converted frames through the filter of a file handle
+ * @param input Converted frames (native s32 or f32)
+ * @param frames Number of input frames
+ * @param output Buffer for the output frames
+ * @return Number of output frames produced
+ */
+static size_t filter_frames( file_handle_t* handle, const void* input, size_t frames, uint8_t* output )
+{
+    const filter_config_t* filter = &handle->driver->filter;
+    convert_stage_t* stage = handle->convert;
+    size_t channels = handle->driver->samples.channels;
+    bool is_float = handle->driver->samples.target_format == DMDEVFS_SAMPLE_F32;
+    const int32_t* int_input = (const int32_t*)input;
+    const float* float_input = (const float*)input;
+    size_t produced = 0;
+
+    if(filter->type == FILTER_FIR)
+    {
+        size_t taps = filter->taps_count;
+        for(size_t frame = 0; frame < frames; frame++)
+        {
+            // Each sample is stored twice, so the window is always contiguous
+            stage->history_position = (stage->history_position + 1) % taps;
+            for(size_t c = 0; c < channels; c++)
+            {
+                float* history = stage->history + c * 2 * taps;
+                float sample = is_float ? float_input[frame * channels + c] : (float)int_input[frame * channels + c];
+                history[stage->history_position] = sample;
+                history[stage->history_position + taps] = sample;
+            }
+            if(++stage->filter_count < filter->decimation)
+            {
+                continue;
+            }
+            // The output is computed only for the frames that are kept
+            for(size_t c = 0; c < channels; c++)
+            {
+                const float* window = stage->history + c * 2 * taps + stage->history_position + 1;
+                float value = dmdevfs_dot_f32(window, filter->taps, taps);
+                if(is_float)
+                {
+                    store_f32(output, produced * channels + c, value);
+                }
+                else
+                {
+                    store_s32(output, produced * channels + c, round_to_s32(value));
+                }
+            }
+            stage->filter_count = 0;
+            produced++;
+        }
+        return produced;
+    }
+
+    size_t offset = 0;
+    while(offset < frames)
+    {
+        size_t take = filter->decimation - stage->filter_count;
+        if(take > frames - offset)
+        {
+            take = frames - offset;
+        }
+        bool first = (stage->filter_count == 0);
+        for(size_t c = 0; c < channels; c++)
+        {
+            filter_accumulator_t* accumulator = &stage->accumulators[c];
+            const int32_t* int_samples = int_input + offset * channels + c;
+            const float* float_samples = float_input + offset * channels + c;
+            switch(filter->type)
+            {
+                case FILTER_AVERAGE:
+                    if(is_float) accumulator->float_sum += dmdevfs_sum_f32(float_samples, take, channels);
+                    else         accumulator->sum += dmdevfs_sum_s32(int_samples, take, channels);
+                    break;
+                case FILTER_MIN:
+                case FILTER_MAX:
+                    if(is_float)
+                    {
+                        accumulator->float_extreme = dmdevfs_extreme_f32(float_samples, take, channels, filter->type == FILTER_MAX,
+                                                                         first ? float_samples[0] : accumulator->float_extreme);
+                    }
+                    else
+                    {
+                        accumulator->extreme = dmdevfs_extreme_s32(int_samples, take, channels, filter->type == FILTER_MAX,
+                                                                   first ? int_samples[0] : accumulator->extreme);
+                    }
+                    break;
+                case FILTER_DECIMATE:
+                    if(first && is_float) accumulator->float_extreme = float_samples[0];
+                    else if(first)        accumulator->extreme = int_samples[0];
+                    break;
+                default:
+                    break;
+            }
+        }
+        stage->filter_count += take;
+        offset += take;
+
+        if(stage->filter_count < filter->decimation)
+        {
+            break;
+        }
+        for(size_t c = 0; c < channels; c++)
+        {
+            filter_accumulator_t* accumulator = &stage->accumulators[c];
+            if(filter->type == FILTER_AVERAGE)
+            {
+                if(is_float) store_f32(output, produced * channels + c, (float)(accumulator->float_sum / (double)filter->decimation));
+                else         store_s32(output, produced * channels + c, (int32_t)(accumulator->sum / (int64_t)filter->decimation));
+            }
+            else
+            {
+                if(is_float) store_f32(output, produced * channels + c, accumulator->float_extreme);
+                else         store_s32(output, produced * channels + c, accumulator->extreme);
+            }
+            accumulator->sum = 0;
+            accumulator->float_sum = 0.0;
+        }
+        stage->filter_count = 0;
+        produced++;
+    }
+    return produced;
+}
+
+/**
+ * @brief Round a filter output to the nearest integer sample, saturating out of range values
+ */
+static int32_t round_to_s32( float value )
+{
+    if(value != value)
+    {
+        return 0;
+    }
+    if(value >= 2147483647.0f)
+    {
+        return INT32_MAX;
+    }
+    if(value <= -2147483648.0f)
+    {
+        return INT32_MIN;
+    }
+    return (int32_t)(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+/**
+ * @brief Store an integer sample in the caller's buffer, which may have any alignment
+ */
+static void store_s32( uint8_t* output, size_t index, int32_t value )
+{
+    memcpy(output + index * sizeof(int32_t), &value, sizeof(value));
+}
+
+/**
+ * @brief Store a float sample in the caller's buffer, which may have any alignment
+ */
+static void store_f32( uint8_t* output, size_t index, float value )
+{
+    memcpy(output + index * sizeof(float), &value, sizeof(value));
+}
+
+/**
+ * @brief Send a control command to the driver of an open file
+ * @param result Value returned by the driver
+ * @return DMFSI_OK if the driver was called, DMFSI_ERR_NOT_FOUND if it has no dmdrvi_ioctl
+ */
+static int driver_ioctl( file_handle_t* handle, int command, void* arg, int* result )
+{
+    if(handle->driver->hostdev != NULL)
+    {
+        // Host devices support the generic fallbacks of the dmdevfs commands only
+        if(DMDEVFS_IOCTL_IS_RESERVED(command))
+        {
+            return DMFSI_ERR_NOT_FOUND;
+        }
+        *result = dmdevfs_hostdev_ioctl(handle->driver_handle, command, arg);
+        return DMFSI_OK;
+    }
+
+    dmod_dmdrvi_ioctl_t dmdrvi_ioctl = Dmod_GetDifFunction(handle->driver->driver, dmod_dmdrvi_ioctl_sig);
+    if(dmdrvi_ioctl == NULL)
+    {
+        return DMFSI_ERR_NOT_FOUND;
+    }
+
+    driver_call_t* call = begin_driver_call(handle->driver, DMDEVFS_OP_IOCTL);
+    DMDEVFS_TRACE(dmdrvi_ioctl_entry, handle->driver, command);
+    *result = dmdrvi_ioctl(handle->driver->driver_context, handle->driver_handle, command, arg);
+    DMDEVFS_TRACE(dmdrvi_ioctl_return, handle->driver, *result);
+    end_driver_call(handle->driver, call);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Check or wait for the readiness of a device once
+ * @return Ready DMDEVFS_POLL_* events (0 on timeout), negative error code otherwise
+ */
+static int device_poll( file_handle_t* handle, int events, int timeout_ms )
+{
+    if(handle->driver->hostdev != NULL)
+    {
+        int ready = dmdevfs_hostdev_poll(handle->driver_handle, events, timeout_ms);
+        return (ready >= 0) ? ready : DMFSI_ERR_GENERAL;
+    }
+
+    dmdevfs_poll_t poll = { events, timeout_ms, 0 };
+    int result = 0;
+    if(driver_ioctl(handle, DMDEVFS_IOCTL_POLL, &poll, &result) == DMFSI_OK && result == 0)
+    {
+        return poll.revents;
+    }
+
+    // Reads and writes of the driver do not block
+    return events & (DMDEVFS_POLL_IN | DMDEVFS_POLL_OUT);
+}
+
+/**
+ * @brief Wait for the readiness of a device in the completion mode of the file
+ * 
+ * At low completion rates the file waits for the notification of the driver.
+ * Once the rate reaches `busy_poll_rate`, the device is polled for up to
+ * `busy_poll_spin_ms` first, which saves the wake-up latency while the next
+ * completion is imminent. Polling ends when the rate drops below half of the
+ * threshold, and never takes more than `busy_poll_budget` percent of the time.
+ */
+static int wait_completion( file_handle_t* handle, int events, int timeout_ms )
+{
+    const completion_config_t* config = &handle->driver->completion;
+    completion_state_t* state = &handle->completion;
+    if(config->busy_poll_rate == 0)
+    {
+        return device_poll(handle, events, timeout_ms);
+    }
+
+    uint64_t start = Dmod_GetTimeMs();
+    update_completion_mode(handle, start);
+
+    uint32_t budget_ms = DMDEVFS_COMPLETION_WINDOW_MS * config->budget_percent / 100;
+    if(state->busy_poll && timeout_ms != 0 && state->spent_ms < budget_ms)
+    {
+        uint32_t spin_ms = config->spin_ms;
+        if(spin_ms > budget_ms - state->spent_ms)       spin_ms = budget_ms - state->spent_ms;
+        if(timeout_ms > 0 && spin_ms > (uint32_t)timeout_ms) spin_ms = (uint32_t)timeout_ms;
+
+        int ready;
+        uint64_t elapsed;
+        do
+        {
+            ready = device_poll(handle, events, 0);
+            elapsed = Dmod_GetTimeMs() - start;
+        } while(ready == 0 && elapsed < spin_ms);
+
+        state->spent_ms += (uint32_t)elapsed;
+        if(ready != 0)
+        {
+            state->completions += (ready > 0) ? 1 : 0;
+            return ready;
+        }
+        if(timeout_ms > 0)
+        {
+            timeout_ms -= (int)elapsed;
+            if(timeout_ms <= 0)
+            {
+                return 0;
+            }
+        }
+    }
+
+    int ready = device_poll(handle, events, timeout_ms);
+    if(ready > 0)
+    {
+        state->completions++;
+    }
+    return ready;
+}
+
+/**
+ * @brief Switch the completion mode of a file at the end of a measurement window
+ */
+static void update_completion_mode( file_handle_t* handle, uint64_t now )
+{
+    const completion_config_t* config = &handle->driver->completion;
+    completion_state_t* state = &handle->completion;
+    uint64_t elapsed = now - state->window_start;
+    if(elapsed < DMDEVFS_COMPLETION_WINDOW_MS)
+    {
+        return;
+    }
+
+    // Hysteresis: enter at the threshold, leave below half of it
+    uint64_t rate = (uint64_t)state->completions * 1000 / elapsed;
+    if(!state->busy_poll && rate >= config->busy_poll_rate)
+    {
+        state->busy_poll = true;
+    }
+    else if(state->busy_poll && rate < config->busy_poll_rate / 2)
+    {
+        state->busy_poll = false;
+    }
+    state->window_start = now;
+    state->completions = 0;
+    state->spent_ms = 0;
+}
 
 /**
- * @brief Extract base name from a path
+ * @brief Open a driver handle used by dmdevfs itself
+ * 
+ * Internal handles let dmdevfs access a device without moving the position of
+ * the files opened by the application.
  */
-static void read_base_name(const char* path, char* base_name, size_t name_size)
+static int open_internal_handle( driver_node_t* node, int mode, file_handle_t* handle )
 {
-    const char* last_slash = strrchr(path, '/');
-    const char* name_start = (last_slash != NULL) ? last_slash + 1 : path;
-    strncpy(base_name, name_start, name_size);
-    base_name[name_size - 1] = '\0';
+    memset(handle, 0, sizeof(file_handle_t));
+    handle->driver = node;
+    handle->path = node->path;
+    handle->mode = mode;
+    int res = driver_open(node, mode, &handle->driver_handle);
+    if(res != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Driver failed to open device: %s\n", node->path);
+        handle->driver_handle = NULL;
+    }
+    return res;
 }
 
 /**
- * @brief Extract directory name from a path, handling trailing slashes
- * @param path Path to extract directory name from (may have trailing slash)
- * @param dir_name Output buffer for directory name
- * @param name_size Size of output buffer
+ * @brief Close a driver handle opened with open_internal_handle()
+ */
+static void close_internal_handle( file_handle_t* handle )
+{
+    release_unpacked(handle);
+    driver_close(handle);
+    handle->driver_handle = NULL;
+}
+
+/**
+ * @brief Read the whole device into a newly allocated buffer
  * 
- * Examples:
- * - "dev/" -> "dev"
- * - "/dev/" -> "dev"
- * - "dmspiflash0/" -> "dmspiflash0"
- * - "/" -> "" (root has no name)
+ * The device is read through an internal handle, so the position of the file
+ * is not changed.
  */
-static void read_dir_name_from_path(const char* path, char* dir_name, size_t name_size)
+static int read_device_copy( driver_node_t* node, int mode, void** data, size_t* size )
 {
-    if (path == NULL || dir_name == NULL || name_size == 0)
+    dmdrvi_stat_t stat = {0};
+    if(driver_stat(node, node->path, &stat) != 0 || stat.size == 0)
     {
-        if (dir_name && name_size > 0)
+        DMOD_LOG_ERROR("Device has no fixed size: %s\n", node->path);
+        return DMFSI_ERR_INVALID;
+    }
+    if(*size != 0 && stat.size > *size)
+    {
+        DMOD_LOG_ERROR("Device is larger than %u bytes: %s\n", (unsigned)*size, node->path);
+        return DMFSI_ERR_NO_SPACE;
+    }
+
+    uint8_t* buffer = Dmod_Malloc(stat.size);
+    if(buffer == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate %u bytes for device copy\n", (unsigned)stat.size);
+        return DMFSI_ERR_NO_SPACE;
+    }
+
+    file_handle_t copy_handle;
+    int res = open_internal_handle(node, mode, &copy_handle);
+    size_t total = 0;
+    while(res == DMFSI_OK && total < stat.size)
+    {
+        size_t received = 0;
+        res = driver_read(&copy_handle, buffer + total, transfer_chunk(node, total, stat.size - total), &received);
+        if(received == 0)
         {
-            dir_name[0] = '\0';
+            break;
         }
-        return;
+        total += received;
+    }
+    if(copy_handle.driver_handle != NULL)
+    {
+        close_internal_handle(&copy_handle);
+    }
+    if(res != DMFSI_OK || total != stat.size)
+    {
+        DMOD_LOG_ERROR("Failed to read the whole device: %s\n", node->path);
+        Dmod_Free(buffer);
+        return (res != DMFSI_OK) ? res : DMFSI_ERR_GENERAL;
     }
 
-    // Find the length without trailing slashes
-    size_t len = strlen(path);
-    while (len > 1 && path[len - 1] == '/')
+    *data = buffer;
+    *size = total;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read a small device into RAM to serve all its reads
+ */
+static int load_shadow( driver_node_t* node )
+{
+    void* data = NULL;
+    size_t size = DMDEVFS_SHADOW_MAX_SIZE;
+    int res = read_device_copy(node, DMFSI_O_RDONLY, &data, &size);
+    if(res != DMFSI_OK)
     {
-        len--;
+        return res;
     }
 
-    // Special case: if path is just "/", return empty
-    if (len == 1 && path[0] == '/')
+    node->shadow = data;
+    node->shadow_size = size;
+    DMOD_LOG_INFO("Shadowed %u bytes of device: %s\n", (unsigned)size, node->path);
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read the block index of a compressed image stored on a device
+ * 
+ * The index is validated completely here, so reads only have to check that
+ * each block decodes to its size.
+ */
+static int load_image_index( driver_node_t* node )
+{
+    dmdrvi_stat_t stat = {0};
+    if(driver_stat(node, node->path, &stat) != 0 || stat.size < sizeof(dmdevfs_image_header_t))
     {
-        dir_name[0] = '\0';
-        return;
+        DMOD_LOG_ERROR("Device has no fixed size: %s\n", node->path);
+        return DMFSI_ERR_INVALID;
     }
 
-    // Find the last slash before the directory name
-    const char* last_slash = NULL;
-    for (size_t i = 0; i < len; i++)
+    file_handle_t handle;
+    int res = open_internal_handle(node, DMFSI_O_RDONLY, &handle);
+    if(res != DMFSI_OK)
     {
-        if (path[i] == '/')
+        return res;
+    }
+
+    uint8_t header[sizeof(dmdevfs_image_header_t)] = {0};
+    res = read_device_range(&handle, 0, header, sizeof(header));
+    size_t block_size = read_le32(header + 4);
+    size_t image_size = read_le32(header + 8);
+    size_t block_count = read_le32(header + 12);
+    size_t index_end = sizeof(header) + (block_count + 1) * sizeof(uint32_t);
+    if(res == DMFSI_OK &&
+       (read_le32(header) != DMDEVFS_IMAGE_MAGIC || block_size == 0 || block_size > DMDEVFS_IMAGE_MAX_BLOCK ||
+        block_count != (image_size + block_size - 1) / block_size || block_count >= stat.size / sizeof(uint32_t) ||
+        index_end > stat.size))
+    {
+        DMOD_LOG_ERROR("No compressed image on device: %s\n", node->path);
+        res = DMFSI_ERR_INVALID;
+    }
+
+    compressed_image_t* image = NULL;
+    uint32_t* offsets = NULL;
+    if(res == DMFSI_OK)
+    {
+        image = Dmod_Malloc(sizeof(compressed_image_t));
+        offsets = Dmod_Malloc((block_count + 1) * sizeof(uint32_t));
+        if(image == NULL || offsets == NULL)
         {
-            last_slash = &path[i];
+            DMOD_LOG_ERROR("Failed to allocate the index of a compressed image\n");
+            res = DMFSI_ERR_NO_SPACE;
         }
     }
+    if(res == DMFSI_OK)
+    {
+        res = read_device_range(&handle, sizeof(header), (uint8_t*)offsets, (block_count + 1) * sizeof(uint32_t));
+    }
+    close_internal_handle(&handle);
 
-    // Extract the directory name
-    const char* name_start = (last_slash != NULL) ? last_slash + 1 : path;
-    size_t name_len = len - (name_start - path);
-    
-    // Use snprintf for safe copying with guaranteed null-termination
-    int written = Dmod_SnPrintf(dir_name, name_size, "%.*s", (int)name_len, name_start);
-    if (written < 0 || (size_t)written >= name_size)
+    size_t max_stored = 0;
+    for(size_t i = 0; res == DMFSI_OK && i <= block_count; i++)
     {
-        // Truncated, but snprintf ensures null-termination
-        dir_name[name_size - 1] = '\0';
+        offsets[i] = read_le32((const uint8_t*)&offsets[i]);
+        if(i == 0)
+        {
+            res = (offsets[0] >= index_end) ? DMFSI_OK : DMFSI_ERR_INVALID;
+            continue;
+        }
+        size_t stored = offsets[i] - offsets[i - 1];
+        size_t decoded = (i < block_count) ? block_size : image_size - (i - 1) * block_size;
+        if(offsets[i] <= offsets[i - 1] || stored > decoded)
+        {
+            res = DMFSI_ERR_INVALID;
+        }
+        else if(stored > max_stored)
+        {
+            max_stored = stored;
+        }
+    }
+    if(res == DMFSI_OK && offsets[block_count] > stat.size)
+    {
+        res = DMFSI_ERR_INVALID;
     }
+    if(res != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Invalid compressed image on device: %s\n", node->path);
+        if(offsets != NULL) Dmod_Free(offsets);
+        if(image != NULL)   Dmod_Free(image);
+        return res;
+    }
+
+    image->block_size = block_size;
+    image->image_size = image_size;
+    image->block_count = block_count;
+    image->max_stored = max_stored;
+    image->offsets = offsets;
+    node->image = image;
+    DMOD_LOG_INFO("Compressed image of %u bytes in %u blocks on device: %s\n", (unsigned)image_size, (unsigned)block_count, node->path);
+    return DMFSI_OK;
 }
 
 /**
- * @brief Read driver name from configuration file
+ * @brief Free the block index of a compressed image
+ */
+static void free_image_index( driver_node_t* node )
+{
+    if(node->image != NULL)
+    {
+        Dmod_Free(node->image->offsets);
+        Dmod_Free(node->image);
+        node->image = NULL;
+    }
+}
+
+/**
+ * @brief Read decoded data of a compressed image at the position of a file
+ * 
+ * The last decoded block is kept in the file, so sequential reads decode
+ * each block once and a seek costs at most one block.
+ */
+static int read_image( file_handle_t* handle, void* buffer, size_t size, size_t* read )
+{
+    const compressed_image_t* image = handle->driver->image;
+    *read = 0;
+    while(*read < size && handle->position < image->image_size)
+    {
+        size_t block = handle->position / image->block_size;
+        if(handle->unpacked == NULL || handle->unpacked_block != block)
+        {
+            int res = unpack_block(handle, block);
+            if(res != DMFSI_OK)
+            {
+                return res;
+            }
+        }
+        size_t offset = handle->position - block * image->block_size;
+        size_t length = handle->unpacked_length - offset;
+        if(length > size - *read)
+        {
+            length = size - *read;
+        }
+        memcpy((uint8_t*)buffer + *read, handle->unpacked + offset, length);
+        *read += length;
+        handle->position += length;
+        if(handle->noreuse && offset + length == handle->unpacked_length)
+        {
+            release_unpacked(handle);
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read and decode a block of a compressed image into the buffer of a file
+ */
+static int unpack_block( file_handle_t* handle, size_t block )
+{
+    driver_node_t* node = handle->driver;
+    const compressed_image_t* image = node->image;
+    if(handle->unpacked == NULL)
+    {
+        handle->unpacked = pool_get(&node->pool, image->block_size);
+        handle->packed = pool_get(&node->pool, image->max_stored);
+        if(handle->unpacked == NULL || handle->packed == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate buffers for compressed image: %s\n", handle->path);
+            release_unpacked(handle);
+            return DMFSI_ERR_NO_SPACE;
+        }
+    }
+
+    size_t offset = image->offsets[block];
+    size_t stored = image->offsets[block + 1] - offset;
+    size_t expected = (block + 1 < image->block_count) ? image->block_size : image->image_size - block * image->block_size;
+    bool raw = stored == expected;
+    int res = read_device_range(handle, offset, raw ? handle->unpacked : handle->packed, stored);
+    if(res != DMFSI_OK)
+    {
+        release_unpacked(handle);
+        return res;
+    }
+
+    size_t decoded = stored;
+    if(!raw && (!dmdevfs_lz4_decode(handle->packed, stored, handle->unpacked, expected, &decoded) || decoded != expected))
+    {
+        DMOD_LOG_ERROR("Corrupted block %u of compressed image: %s\n", (unsigned)block, handle->path);
+        release_unpacked(handle);
+        return DMFSI_ERR_GENERAL;
+    }
+    handle->unpacked_block = block;
+    handle->unpacked_length = decoded;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read a range of the device of a file, independently of its position
+ * 
+ * Shadowed devices are served from the shadow. Other devices are moved with
+ * DMDEVFS_IOCTL_SEEK, or reopened and read forward when the driver has no
+ * position; sequential ranges need neither.
+ */
+static int read_device_range( file_handle_t* handle, size_t offset, uint8_t* buffer, size_t size )
+{
+    driver_node_t* node = handle->driver;
+    if(node->shadow != NULL)
+    {
+        if(offset > node->shadow_size || size > node->shadow_size - offset)
+        {
+            return DMFSI_ERR_INVALID;
+        }
+        memcpy(buffer, node->shadow + offset, size);
+        return DMFSI_OK;
+    }
+
+    // The buffer holds the skipped data until the range is reached
+    int res = seek_device(handle, offset, buffer, size);
+    size_t total = 0;
+    while(res == DMFSI_OK && total < size)
+    {
+        size_t received = 0;
+        res = device_read(handle, buffer + total, transfer_chunk(node, handle->device_position, size - total), &received);
+        if(res == DMFSI_OK && received == 0)
+        {
+            res = DMFSI_ERR_GENERAL;
+        }
+        total += received;
+    }
+    if(res != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Failed to read %u bytes at offset %u of device: %s\n", (unsigned)size, (unsigned)offset, node->path);
+    }
+    return res;
+}
+
+/**
+ * @brief Move the driver handle of a file to an offset of the device
+ * 
+ * Uses DMDEVFS_IOCTL_SEEK. Drivers without it are reopened when moving
+ * backwards and read forward into @p scratch.
+ */
+static int seek_device( file_handle_t* handle, size_t offset, uint8_t* scratch, size_t scratch_size )
+{
+    driver_node_t* node = handle->driver;
+    if(handle->device_position == offset)
+    {
+        return DMFSI_OK;
+    }
+
+    dmdevfs_seek_t seek = { (long)offset, DMFSI_SEEK_SET, -1 };
+    int result = 0;
+    if(driver_ioctl(handle, DMDEVFS_IOCTL_SEEK, &seek, &result) == DMFSI_OK && result == 0)
+    {
+        handle->device_position = offset;
+        return DMFSI_OK;
+    }
+    if(offset < handle->device_position)
+    {
+        driver_close(handle);
+        int res = driver_open(node, handle->mode, &handle->driver_handle);
+        if(res != DMFSI_OK)
+        {
+            DMOD_LOG_ERROR("Failed to reopen device: %s\n", node->path);
+            handle->driver_handle = NULL;
+            return res;
+        }
+        handle->device_position = 0;
+    }
+
+    while(handle->device_position < offset)
+    {
+        size_t skip = offset - handle->device_position;
+        size_t received = 0;
+        int res = device_read(handle, scratch, transfer_chunk(node, handle->device_position, (skip < scratch_size) ? skip : scratch_size), &received);
+        if(res != DMFSI_OK || received == 0)
+        {
+            DMOD_LOG_ERROR("Failed to move to offset %u of device: %s\n", (unsigned)offset, node->path);
+            return (res != DMFSI_OK) ? res : DMFSI_ERR_GENERAL;
+        }
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Check if reading ahead of the position is harmless for the device of a node
+ * 
+ * Streams are never read ahead, as reading them consumes data that may not
+ * be wanted (and may block). Shadowed devices and compressed images have
+ * their own caches.
+ */
+static bool can_read_ahead( driver_node_t* node )
+{
+    if(node->shadow != NULL || node->image != NULL)
+    {
+        return false;
+    }
+    if(!node->caps_ready)
+    {
+        build_caps(node);
+    }
+    return !(node->caps.flags & DMDEVFS_CAP_STREAM);
+}
+
+/**
+ * @brief Set the read-ahead window of a file
+ * 
+ * The window is 0 where reading ahead does not apply, so hints never fail on
+ * such devices.
+ */
+static int set_readahead( file_handle_t* handle, size_t window )
+{
+    if(window > 0 && !can_read_ahead(handle->driver))
+    {
+        window = 0;
+    }
+    int res = drop_readahead(handle);
+    if(res != DMFSI_OK)
+    {
+        return res;
+    }
+
+    if(window == 0 || window > handle->readahead_capacity)
+    {
+        release_readahead(handle);
+    }
+    if(window > 0 && handle->readahead == NULL)
+    {
+        handle->readahead = pool_get(&handle->driver->pool, window);
+        if(handle->readahead == NULL)
+        {
+            DMOD_LOG_ERROR("Failed to allocate %u bytes for read-ahead: %s\n", (unsigned)window, handle->path);
+            handle->readahead_window = 0;
+            return DMFSI_ERR_NO_SPACE;
+        }
+        handle->readahead_capacity = window;
+    }
+    handle->readahead_window = window;
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Read through the read-ahead buffer of a file
+ * 
+ * The buffer is refilled with a whole window when it is consumed; requests at
+ * least as large as the window go to the driver directly.
+ */
+static int read_ahead( file_handle_t* handle, void* buffer, size_t size, size_t* read )
+{
+    *read = 0;
+    while(*read < size)
+    {
+        size_t end = handle->readahead_start + handle->readahead_length;
+        if(handle->readahead_length > 0 && handle->position < end)
+        {
+            size_t length = end - handle->position;
+            if(length > size - *read)
+            {
+                length = size - *read;
+            }
+            memcpy((uint8_t*)buffer + *read, handle->readahead + (handle->position - handle->readahead_start), length);
+            *read += length;
+            handle->position += length;
+            continue;
+        }
+
+        // The buffer is consumed, so the driver is at the position again
+        handle->readahead_length = 0;
+        size_t received = 0;
+        if(size - *read >= handle->readahead_window)
+        {
+            if(handle->readahead_window == 0)
+            {
+                // Data prefetched without a window is not kept
+                release_readahead(handle);
+            }
+            int res = device_read(handle, (uint8_t*)buffer + *read, size - *read, &received);
+            *read += received;
+            handle->position += received;
+            return res;
+        }
+        int res = device_read(handle, handle->readahead, handle->readahead_window, &received);
+        if(res != DMFSI_OK || received == 0)
+        {
+            return res;
+        }
+        handle->readahead_start = handle->position;
+        handle->readahead_length = received;
+    }
+    return DMFSI_OK;
+}
+
+/**
+ * @brief Discard the read-ahead data of a file and move the driver back to its position
+ */
+static int drop_readahead( file_handle_t* handle )
+{
+    if(handle->readahead_length == 0)
+    {
+        return DMFSI_OK;
+    }
+    handle->readahead_length = 0;
+    return seek_device(handle, handle->position, handle->readahead, handle->readahead_capacity);
+}
+
+/**
+ * @brief Return the read-ahead buffer of a file to the pool of its node
+ * @note The read-ahead data must be dropped first
+ */
+static void release_readahead( file_handle_t* handle )
+{
+    if(handle->readahead != NULL)
+    {
+        pool_put(handle->readahead);
+        handle->readahead = NULL;
+        handle->readahead_capacity = 0;
+    }
+}
+
+/**
+ * @brief Read data a file is going to need into its buffers
+ * 
+ * Compressed images decode the block at @p offset. Other devices are read
+ * ahead only at the position of the file, where the driver already is.
  */
-static dmini_context_t read_driver_for_config(const char* config_path, char* driver_name, size_t name_size, const char* default_driver)
+static int prefetch( file_handle_t* handle, size_t offset, size_t end )
 {
-    dmini_context_t ctx = dmini_create();
-    if (ctx == NULL)
+    const compressed_image_t* image = handle->driver->image;
+    if(image != NULL)
     {
-        DMOD_LOG_ERROR("Failed to create INI context\n");
-        return NULL;
+        size_t block = offset / image->block_size;
+        if(offset >= image->image_size || (handle->unpacked != NULL && handle->unpacked_block == block))
+        {
+            return DMFSI_OK;
+        }
+        return unpack_block(handle, block);
     }
-
-    int res = dmini_parse_file(ctx, config_path);
-    if (res != DMINI_OK)
+    if(offset != handle->position || handle->readahead_length > 0 || !can_read_ahead(handle->driver))
     {
-        DMOD_LOG_ERROR("Failed to parse INI file: %s\n", config_path);
-        dmini_destroy(ctx);
-        return NULL;  
+        return DMFSI_OK;
     }
 
-    const char* name = dmini_get_string(ctx, "main", "driver_name", default_driver);
-    if(name != NULL)
+    size_t size = (handle->readahead_capacity > DMDEVFS_READAHEAD_SIZE) ? handle->readahead_capacity : DMDEVFS_READAHEAD_SIZE;
+    if(end - offset < size)
     {
-        strncpy(driver_name, name, name_size);
-        driver_name[name_size - 1] = '\0';
-        return ctx;
+        size = end - offset;
     }
-    
-    read_base_name(config_path, driver_name, name_size);
-
-    // cut the `.ini` extension if present
-    char* ext = strrchr(driver_name, '.');
-    if (ext != NULL && strcmp(ext, ".ini") == 0)
+    if(size > handle->readahead_capacity)
     {
-        *ext = '\0';
+        release_readahead(handle);
+        handle->readahead = pool_get(&handle->driver->pool, size);
+        if(handle->readahead == NULL)
+        {
+            handle->readahead_window = 0;
+            return DMFSI_ERR_NO_SPACE;
+        }
+        handle->readahead_capacity = size;
     }
-    return ctx;
+
+    size_t received = 0;
+    int res = device_read(handle, handle->readahead, size, &received);
+    handle->readahead_start = handle->position;
+    handle->readahead_length = received;
+    return res;
 }
 
 /**
- * @brief Prepare and load a driver module
+ * @brief Release the buffered data of a file that overlaps a range
  */
-static Dmod_Context_t* prepare_driver_module(const char* driver_name, bool* was_loaded, bool* was_enabled)
+static int evict( file_handle_t* handle, size_t offset, size_t end )
 {
-    *was_loaded = Dmod_IsModuleLoaded(driver_name);
-    *was_enabled = Dmod_IsModuleEnabled(driver_name);
-    Dmod_Context_t* driver = Dmod_LoadModuleByName(driver_name);
-    if (driver == NULL)
+    const compressed_image_t* image = handle->driver->image;
+    if(image != NULL && handle->unpacked != NULL)
     {
-        DMOD_LOG_ERROR("Failed to load driver module: %s\n", driver_name);
-        return NULL;
+        size_t block_start = handle->unpacked_block * image->block_size;
+        if(block_start < end && offset < block_start + handle->unpacked_length)
+        {
+            release_unpacked(handle);
+        }
     }
-    if (!*was_enabled && !Dmod_EnableModule(driver_name, true, NULL))
+
+    size_t start = handle->readahead_start;
+    if(handle->readahead_length > 0 && start < end && offset < start + handle->readahead_length)
     {
-        DMOD_LOG_ERROR("Failed to enable driver module: %s\n", driver_name);
-        if(!*was_loaded)
+        int res = drop_readahead(handle);
+        if(handle->readahead_window == 0)
         {
-            Dmod_UnloadModule(driver_name, false);
+            release_readahead(handle);
         }
-        return NULL;
+        return res;
     }
-
-    DMOD_LOG_INFO("Prepared driver module: %s (was_loaded: %d, was_enabled: %d)\n", driver_name, *was_loaded, *was_enabled);
-    return driver;
+    return DMFSI_OK;
 }
 
 /**
- * @brief Cleanup and unload a driver module
+ * @brief Return the decoding buffers of a file to the pool of its node
  */
-static void cleanup_driver_module(const char* driver_name, bool was_loaded, bool was_enabled)
+static void release_unpacked( file_handle_t* handle )
 {
-    if(!was_enabled)
+    if(handle->unpacked != NULL)
     {
-        Dmod_DisableModule(driver_name, false);
+        pool_put(handle->unpacked);
+        handle->unpacked = NULL;
     }
-    if(!was_loaded)
+    if(handle->packed != NULL)
     {
-        Dmod_UnloadModule(driver_name, false);
+        pool_put(handle->packed);
+        handle->packed = NULL;
     }
 }
 
 /**
- * @brief Read the path associated with a driver directory
+ * @brief Read a little-endian 32-bit value
  */
-static int read_driver_parent_directory( const driver_node_t* node, char* path_buffer, size_t buffer_size )
+static uint32_t read_le32( const uint8_t* data )
 {
-    if (node == NULL || path_buffer == NULL || buffer_size == 0)
-    {
-        return DMFSI_ERR_INVALID;
-    }
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
 
-    memset(path_buffer, 0, buffer_size);
-    const char* driver_name = Dmod_GetName( node->driver );
-    if(driver_name == NULL)
-    {
-        return DMFSI_ERR_NOT_FOUND;
-    }
-    bool major_given = (node->dev_num.flags & DMDRVI_NUM_MAJOR) != 0;
-    bool minor_given = (node->dev_num.flags & DMDRVI_NUM_MINOR) != 0;
-    if(major_given && minor_given)
+/**
+ * @brief Set the transfer size of a node from its configuration or by calibration
+ * 
+ * With `calibrate = true` the result is kept in the node, so it is measured
+ * once per driver set and shared by all mounts of the configuration. The
+ * configuration file is never written; `transfer_size` and
+ * `transfer_alignment` can be given there by hand to skip the measurement.
+ */
+static void configure_transfer_size( driver_node_t* node, dmini_context_t config_ctx )
+{
+    int transfer_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "transfer_size", 0);
+    int alignment = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "transfer_alignment", 1);
+    if(transfer_size > 0)
     {
-        Dmod_SnPrintf(path_buffer, buffer_size, "%s%u/", driver_name, node->dev_num.major);
+        node->transfer_size = (size_t)transfer_size;
+        node->transfer_alignment = (alignment > 0) ? (size_t)alignment : 1;
+        return;
     }
-    else if(minor_given)
+    if(!read_flag(config_ctx, "calibrate"))
     {
-        Dmod_SnPrintf(path_buffer, buffer_size, "%sx/", driver_name);
+        return;
     }
-    else 
+
+    size_t best_alignment = 1;
+    size_t best_size = calibrate_transfer_size(node, &best_alignment);
+    if(best_size == 0)
     {
-        strncpy(path_buffer, ROOT_DIRECTORY_NAME, buffer_size);
+        DMOD_LOG_WARN("Device cannot be calibrated: %s\n", node->path);
+        return;
     }
-    return DMFSI_OK;
+    node->transfer_size = best_size;
+    node->transfer_alignment = best_alignment;
+    DMOD_LOG_INFO("Calibrated device %s: transfer_size = %u, transfer_alignment = %u\n", node->path, (unsigned)best_size, (unsigned)best_alignment);
 }
 
 /**
- * @brief Read the path associated with a driver node
+ * @brief Find the read size with the best throughput of a device
+ * 
+ * Only devices with a fixed size are calibrated; their reads do not consume
+ * data. Sizes from DMDEVFS_CALIBRATE_MIN_SIZE to DMDEVFS_CALIBRATE_MAX_SIZE are
+ * each read for DMDEVFS_CALIBRATE_TIME_MS. The best size is then read at
+ * offsets aligned to it and at offsets shifted by half of it: if the shifted
+ * reads are more than 10% slower, internal transfers are also aligned.
+ * 
+ * @return Best transfer size, 0 if the device cannot be calibrated
  */
-static int read_driver_node_path( const driver_node_t* node, char* path_buffer, size_t buffer_size )
+static size_t calibrate_transfer_size( driver_node_t* node, size_t* alignment )
 {
-    if (node == NULL || path_buffer == NULL || buffer_size == 0)
+    dmdrvi_stat_t stat = {0};
+    if(driver_stat(node, node->path, &stat) != 0 || stat.size < DMDEVFS_CALIBRATE_MIN_SIZE)
     {
-        return DMFSI_ERR_INVALID;
+        return 0;
     }
-    memset(path_buffer, 0, buffer_size);    
 
-    if(read_driver_parent_directory( node, path_buffer, buffer_size ) != DMFSI_OK)
+    uint8_t* buffer = pool_get(&node->pool, DMDEVFS_CALIBRATE_MAX_SIZE);
+    if(buffer == NULL)
     {
-        return DMFSI_ERR_GENERAL;
+        return 0;
     }
-    bool major_given = (node->dev_num.flags & DMDRVI_NUM_MAJOR) != 0;
-    bool minor_given = (node->dev_num.flags & DMDRVI_NUM_MINOR) != 0;
-    size_t current_length = strlen(path_buffer);
-    if(current_length >= buffer_size)
+
+    size_t best_size = 0;
+    uint64_t best_rate = 0;
+    for(size_t size = DMDEVFS_CALIBRATE_MIN_SIZE; size <= DMDEVFS_CALIBRATE_MAX_SIZE && size <= stat.size; size *= 2)
     {
-        DMOD_LOG_ERROR("Buffer too small for driver path\n");
-        return DMFSI_ERR_NO_SPACE;
+        // Larger sizes must be clearly faster to win
+        uint64_t rate = measure_read_rate(node, buffer, stat.size, size, 0);
+        if(best_size == 0 || rate > best_rate + best_rate / 20)
+        {
+            best_size = size;
+            best_rate = rate;
+        }
     }
-    path_buffer += current_length;
-    buffer_size -= current_length;
-    if(minor_given)
+
+    // Both runs skip the start of the device with one read, so they restart
+    // equally often and differ only in the alignment of the reads
+    *alignment = 1;
+    if(best_size > 1 && best_size * 2 <= stat.size)
     {
-        Dmod_SnPrintf(path_buffer, buffer_size, "%u", node->dev_num.minor);
+        uint64_t aligned_rate = measure_read_rate(node, buffer, stat.size, best_size, best_size);
+        uint64_t unaligned_rate = measure_read_rate(node, buffer, stat.size, best_size, best_size / 2);
+        if(unaligned_rate < aligned_rate - aligned_rate / 10)
+        {
+            *alignment = best_size;
+        }
     }
-    else 
+    pool_put(buffer);
+    return (best_rate > 0) ? best_size : 0;
+}
+
+/**
+ * @brief Measure the throughput of reads of one size
+ * @param skip Bytes read first to shift the following reads from the start of the device
+ * @return Bytes per second
+ */
+static uint64_t measure_read_rate( driver_node_t* node, uint8_t* buffer, size_t device_size, size_t size, size_t skip )
+{
+    file_handle_t handle;
+    if(open_internal_handle(node, DMFSI_O_RDONLY, &handle) != DMFSI_OK)
     {
-        const char* driver_name = Dmod_GetName( node->driver );
-        if(driver_name == NULL)
+        return 0;
+    }
+
+    size_t received = 0;
+    if(skip > 0 && (device_read(&handle, buffer, skip, &received) != DMFSI_OK || received != skip))
+    {
+        close_internal_handle(&handle);
+        return 0;
+    }
+
+    uint64_t bytes = 0;
+    uint64_t start = Dmod_GetTimeMs();
+    uint64_t elapsed = 0;
+    do
+    {
+        if(handle.device_position + size > device_size)
         {
-            return DMFSI_ERR_NOT_FOUND;
+            // Start over at the same offset, the device has a fixed size
+            close_internal_handle(&handle);
+            if(open_internal_handle(node, DMFSI_O_RDONLY, &handle) != DMFSI_OK)
+            {
+                return 0;
+            }
+            if(skip > 0 && (device_read(&handle, buffer, skip, &received) != DMFSI_OK || received != skip))
+            {
+                break;
+            }
         }
-        if(major_given)
+        if(device_read(&handle, buffer, size, &received) != DMFSI_OK || received == 0)
         {
-            Dmod_SnPrintf(path_buffer, buffer_size, "%s%u", driver_name, node->dev_num.major);
+            break;
         }
-        else 
+        bytes += received;
+        elapsed = Dmod_GetTimeMs() - start;
+    } while(elapsed < DMDEVFS_CALIBRATE_TIME_MS);
+
+    close_internal_handle(&handle);
+    return bytes * 1000 / ((elapsed > 0) ? elapsed : 1);
+}
+
+/**
+ * @brief Limit an internal transfer to the calibrated size and alignment of a node
+ * @param position Offset of the transfer in the device
+ */
+static size_t transfer_chunk( const driver_node_t* node, size_t position, size_t size )
+{
+    if(node->transfer_size == 0)
+    {
+        return size;
+    }
+
+    size_t limit = node->transfer_size;
+    if(node->transfer_alignment > 1)
+    {
+        size_t to_boundary = node->transfer_alignment - position % node->transfer_alignment;
+        if(to_boundary < limit)
         {
-            strncpy(path_buffer, driver_name, buffer_size);
+            limit = to_boundary;
         }
     }
-    return DMFSI_OK;
+    return (size < limit) ? size : limit;
 }
 
 /**
- * @brief Compare two paths, ignoring trailing slashes
- * @param path1 First path to compare
- * @param path2 Second path to compare  
- * @return 0 if equal, non-zero if different
+ * @brief Read the capability options from the driver configuration
  * 
- * Note: The root path "/" is treated specially and retains its slash.
- * For example, "/" and "//" are considered equal, but "dir" and "dir/" are also equal.
+ * Example:
+ * [dmdevfs]
+ * io_size = 256
+ * max_io_size = 4096
+ * io_alignment = 256
+ * erase_size = 4096
+ * queue_depth = 1
+ * seekable = true
  */
-static int compare_paths_ignore_trailing_slash( const char* path1, const char* path2 )
+static void read_caps_config( dmini_context_t config_ctx, caps_config_t* config )
 {
-    // Handle NULL pointers - both NULL is equal, one NULL is different
-    if (path1 == NULL && path2 == NULL)
+    config->io_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "io_size", -1);
+    config->max_io_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "max_io_size", -1);
+    config->io_alignment = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "io_alignment", -1);
+    config->erase_size = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "erase_size", -1);
+    config->queue_depth = dmini_get_int(config_ctx, DMDEVFS_CONFIG_SECTION, "queue_depth", -1);
+    config->seekable = -1;
+    if(dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, "seekable", NULL) != NULL)
     {
-        return 0;
+        config->seekable = read_flag(config_ctx, "seekable") ? 1 : 0;
     }
-    if (path1 == NULL || path2 == NULL)
+}
+
+/**
+ * @brief Build the capability descriptor of a node
+ * 
+ * Starts from what dmdevfs knows, lets the driver overwrite it through
+ * DMDEVFS_IOCTL_GET_CAPS, and applies the options of the configuration last.
+ * A device is seekable if it is shadowed, holds a compressed image, or
+ * accepts DMDEVFS_IOCTL_SEEK.
+ */
+static void build_caps( driver_node_t* node )
+{
+    dmdevfs_caps_t* caps = &node->caps;
+    memset(caps, 0, sizeof(dmdevfs_caps_t));
+    caps->preferred_size = node->transfer_size;
+    caps->alignment = node->transfer_alignment;
+    caps->buffer_alignment = node->pool.alignment;
+    caps->queue_depth = 1;
+
+    dmdrvi_stat_t stat = {0};
+    if(driver_stat(node, node->path, &stat) == 0 && stat.size > 0)
     {
-        return 1;
+        caps->flags |= DMDEVFS_CAP_FIXED_SIZE;
     }
 
-    // Get lengths
-    size_t len1 = strlen(path1);
-    size_t len2 = strlen(path2);
-    
-    // Remove trailing slashes from both paths for comparison
-    // Keep at least "/" if that's the entire path (len > 1 ensures we keep root "/")
-    while (len1 > 1 && path1[len1 - 1] == '/')
+    file_handle_t handle;
+    if(open_internal_handle(node, DMFSI_O_RDONLY, &handle) == DMFSI_OK)
     {
-        len1--;
+        // Seeking by zero from the current position has no side effects
+        dmdevfs_seek_t seek = { 0, DMFSI_SEEK_CUR, -1 };
+        int result = 0;
+        if(node->shadow != NULL || node->image != NULL ||
+           (driver_ioctl(&handle, DMDEVFS_IOCTL_SEEK, &seek, &result) == DMFSI_OK && result == 0 && seek.position >= 0))
+        {
+            caps->flags |= DMDEVFS_CAP_SEEKABLE;
+        }
+        dmdevfs_caps_t driver_caps = *caps;
+        if(driver_ioctl(&handle, DMDEVFS_IOCTL_GET_CAPS, &driver_caps, &result) == DMFSI_OK && result == 0)
+        {
+            *caps = driver_caps;
+        }
+        close_internal_handle(&handle);
     }
-    while (len2 > 1 && path2[len2 - 1] == '/')
+
+    const caps_config_t* config = &node->caps_config;
+    if(config->io_size > 0)         caps->preferred_size = (size_t)config->io_size;
+    if(config->max_io_size > 0)     caps->max_size = (size_t)config->max_io_size;
+    if(config->io_alignment > 0)    caps->alignment = (size_t)config->io_alignment;
+    if(config->erase_size >= 0)     caps->erase_size = (size_t)config->erase_size;
+    if(config->queue_depth > 0)     caps->queue_depth = (uint32_t)config->queue_depth;
+    if(config->seekable == 1)       caps->flags |= DMDEVFS_CAP_SEEKABLE;
+    if(config->seekable == 0)       caps->flags &= ~DMDEVFS_CAP_SEEKABLE;
+
+    if(!(caps->flags & (DMDEVFS_CAP_SEEKABLE | DMDEVFS_CAP_FIXED_SIZE)))
     {
-        len2--;
+        caps->flags |= DMDEVFS_CAP_STREAM;
     }
-    
-    // Lengths must match
-    if (len1 != len2)
+    if(caps->alignment == 0)
     {
-        return 1;
+        caps->alignment = 1;
     }
-    
-    // Content must match
-    return strncmp(path1, path2, len1);
+    node->caps_ready = true;
 }
 
 /**
- * @brief Compare the path of a driver directory with a given path
- * 
- * This function compares the parent directory of a driver node with a given path.
- * It's used by opendir/readdir to find all driver nodes that belong to a specific directory.
- * 
- * @param data Pointer to driver_node_t
- * @param user_data Pointer to directory path string
- * @return 0 if the node's parent matches the given path, non-zero otherwise
- * 
- * Example: When listing directory "dmspiflash0", this function finds all nodes
- * whose parent directory is "dmspiflash0" (e.g., nodes with path "dmspiflash0/1").
+ * @brief Write through the write-back buffer of a file
  * 
- * Note: Trailing slashes are ignored in comparison, so "dmspiflash0" matches "dmspiflash0/".
+ * The data is only copied into the buffer unless it does not fit; the buffer
+ * is then written to the driver first, and data larger than the buffer goes
+ * to the driver directly.
  */
-static int compare_driver_directory( const void* data, const void* user_data )
+static int buffer_write( dmfsi_context_t ctx, file_handle_t* handle, const void* buffer, size_t size, size_t* written )
 {
-    const driver_node_t* node = (const driver_node_t*)data;
-    const char* path = (const char*)user_data;
-    if (node == NULL || path == NULL)
+    *written = 0;
+    size_t capacity = handle->write_capacity;
+    if(handle->dirty_length + size > capacity)
     {
-        return 0;
+        handle->write_tuner.full++;
+        int res = flush_write_buffer(ctx, handle);
+        if(res != DMFSI_OK)
+        {
+            return take_flush_error(handle, res);
+        }
     }
-
-    char parent_dir[MAX_PATH_LENGTH] = {0};
-    if(read_driver_parent_directory(node, parent_dir, sizeof(parent_dir)) != 0)
+    if(size >= capacity)
     {
-        return -1;
+        return driver_write(handle, buffer, size, written);
     }
 
-    // Use helper function to compare paths, handling optional trailing slashes
-    // This ensures exact path matching (not prefix matching) which is critical
-    // to prevent "/" from incorrectly matching subdirectories like "dmspiflash0/"
-    return compare_paths_ignore_trailing_slash(path, parent_dir);
+    if(handle->dirty_length == 0)
+    {
+        // Append to the list, so the files are kept from the oldest data
+        file_handle_t** link = &ctx->dirty_files;
+        while(*link != NULL)
+        {
+            link = &(*link)->next_dirty;
+        }
+        *link = handle;
+        handle->next_dirty = NULL;
+        handle->dirty_since = Dmod_GetTimeMs();
+    }
+    memcpy(handle->write_buffer + handle->dirty_length, buffer, size);
+    handle->dirty_length += size;
+    ctx->dirty_bytes += size;
+    *written = size;
+    return DMFSI_OK;
 }
 
 /**
- * @brief Compare the path of a driver node with a given path
+ * @brief Write the write-back buffer of a file to the driver in one call
+ * 
+ * If the driver accepts only a part of the data, the rest is moved to the
+ * start of the buffer and the file stays dirty, so the next flush retries it;
+ * DMFSI_ERR_GENERAL is returned meanwhile. If the driver fails, the data is
+ * dropped and the error is kept in the file until it is reported by fflush,
+ * sync or fclose.
  */
-static int compare_driver_node_path( const void* data, const void* user_data )
+static int flush_write_buffer( dmfsi_context_t ctx, file_handle_t* handle )
 {
-    const driver_node_t* node = (const driver_node_t*)data;
-    const char* path = (const char*)user_data;
-    if (node == NULL || path == NULL)
+    if(handle->dirty_length == 0)
     {
-        return 0;
+        return DMFSI_OK;
+    }
+
+    size_t written = 0;
+    uint64_t start = handle->driver->tuning.enabled ? Dmod_GetTimeMs() : 0;
+    int res = DMFSI_OK;
+    while(res == DMFSI_OK && written < handle->dirty_length)
+    {
+        size_t chunk = transfer_chunk(handle->driver, handle->position, handle->dirty_length - written);
+        size_t accepted = 0;
+        res = driver_write(handle, handle->write_buffer + written, chunk, &accepted);
+        written += accepted;
+        if(accepted < chunk)
+        {
+            break;
+        }
+    }
+    if(handle->driver->tuning.enabled)
+    {
+        record_transfer(&handle->write_tuner, written, Dmod_GetTimeMs() - start, false);
+    }
+    if(res == DMFSI_OK && written < handle->dirty_length)
+    {
+        // The device is full for now, keep the rest for the next flush
+        size_t remaining = handle->dirty_length - written;
+        memmove(handle->write_buffer, handle->write_buffer + written, remaining);
+        handle->dirty_length = remaining;
+        ctx->dirty_bytes -= written;
+        return DMFSI_ERR_GENERAL;
+    }
+    if(res != DMFSI_OK)
+    {
+        DMOD_LOG_ERROR("Failed to write back %u bytes to device: %s\n", (unsigned)(handle->dirty_length - written), handle->path);
+        handle->write_error = res;
     }
+    discard_write_buffer(ctx, handle);
 
-    return strcmp(node->path, path);
+    // The buffer is empty, so this is the moment to resize it
+    size_t capacity = tune_buffer(&handle->driver->tuning, &handle->write_tuner, handle->write_capacity);
+    if(capacity != handle->write_capacity)
+    {
+        uint8_t* buffer = pool_get(&handle->driver->pool, capacity);
+        if(buffer != NULL)
+        {
+            pool_put(handle->write_buffer);
+            update_buffer_bytes(handle->write_capacity, capacity);
+            handle->write_buffer = buffer;
+            handle->write_capacity = capacity;
+        }
+    }
+    return res;
 }
 
 /**
- * @brief Compare a driver node with a given driver node
+ * @brief Empty the write-back buffer of a file and take it off the dirty list
  */
-static int compare_driver(const void* data, const void* user_data )
+static void discard_write_buffer( dmfsi_context_t ctx, file_handle_t* handle )
 {
-    const driver_node_t* node = (const driver_node_t*)data;
-    const driver_node_t* target = (const driver_node_t*)user_data;
-    if (node == NULL || target == NULL)
+    file_handle_t** link = &ctx->dirty_files;
+    while(*link != handle)
     {
-        return -1;
+        link = &(*link)->next_dirty;
     }
-
-    return (node == target) ? 0 : -1;
+    *link = handle->next_dirty;
+    handle->next_dirty = NULL;
+    ctx->dirty_bytes -= handle->dirty_length;
+    handle->dirty_length = 0;
 }
 
 /**
- * @brief Check if a path is a directory
+ * @brief Get the result of a flush of the write-back buffer for the application
+ * @return The pending write-back error of the file, else @p res of flush_write_buffer()
  */
-static bool is_directory( dmfsi_context_t ctx, const char* path )
+static int take_flush_error( file_handle_t* handle, int res )
 {
-    return strcmp(path, ROOT_DIRECTORY_NAME) == 0 || dmlist_find(ctx->drivers, path, compare_driver_directory) != NULL;
+    int error = take_write_error(handle);
+    return (error != DMFSI_OK) ? error : res;
 }
 
 /**
- * @brief Get the next driver node in a directory
+ * @brief Get and clear the pending write-back error of a file
  */
-static driver_node_t* get_next_driver_node( dmfsi_context_t ctx, driver_node_t* current, const char* path )
+static int take_write_error( file_handle_t* handle )
 {
-    return dmlist_find_next(ctx->drivers, current, path, compare_driver_directory);
+    int res = handle->write_error;
+    handle->write_error = DMFSI_OK;
+    return res;
 }
 
 /**
- * @brief Find a driver node by its path
+ * @brief Read a boolean option from the [dmdevfs] section
  */
-static driver_node_t* find_driver_node( dmfsi_context_t ctx, const char* path )
+static bool read_flag( dmini_context_t config_ctx, const char* name )
 {
-    return dmlist_find(ctx->drivers, path, compare_driver_node_path);
+    const char* value = dmini_get_string(config_ctx, DMDEVFS_CONFIG_SECTION, name, NULL);
+    return value != NULL && (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 ||
+                             strcmp(value, "yes") == 0 || strcmp(value, "on") == 0);
 }
 
 /**
- * @brief Get file statistics from a driver
+ * @brief Release the memory mapping of an open file
  */
-static int driver_stat( driver_node_t* context, const char* path, dmdrvi_stat_t* stat )
+static void release_mapping( file_handle_t* handle )
 {
-    if (context == NULL || stat == NULL)
+    if(handle->mapping == NULL)
     {
-        return DMFSI_ERR_INVALID;
+        return;
     }
 
-    dmod_dmdrvi_stat_t dmdrvi_stat = Dmod_GetDifFunction(context->driver, dmod_dmdrvi_stat_sig);
-    if (dmdrvi_stat == NULL)
+    if(handle->mapping_is_copy)
     {
-        DMOD_LOG_ERROR("Driver module does not implement dmdrvi_stat\n");
-        return DMFSI_ERR_NOT_FOUND;
+        Dmod_Free(handle->mapping);
     }
-
-    return dmdrvi_stat(context->driver_context, path, stat);
-}
\ No newline at end of file
+    else
+    {
+        dmdevfs_map_t map = { handle->mapping, handle->mapping_length };
+        int result = 0;
+        driver_ioctl(handle, DMDEVFS_IOCTL_UNMAP, &map, &result);
+    }
+    handle->mapping = NULL;
+    handle->mapping_length = 0;
+    handle->mapping_is_copy = false;
+}
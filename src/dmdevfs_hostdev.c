@@ -0,0 +1,314 @@
+/**
+ * @file dmdevfs_hostdev.c
+ * @brief DMOD Driver File System - Linux host device backend
+ * @author Patryk Kubiak
+ */
+
+#ifdef DMDEVFS_ENABLE_HOSTDEV
+
+#define _GNU_SOURCE
+#include "dmod.h"
+#include "dmdevfs.h"
+#include "dmdevfs_hostdev.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * @brief Host device of a node
+ */
+struct dmdevfs_hostdev
+{
+    char name[DMOD_MAX_MODULE_NAME_LENGTH];     // Name of the node
+    char* path;                                 // Path of the host device
+};
+
+/**
+ * @brief Host device opened by a file
+ */
+struct dmdevfs_hostdev_file
+{
+    int fd;                 // Non-blocking descriptor of the device
+    int epoll_fd;           // Epoll instance watching the descriptor
+    uint32_t interest;      // Events currently registered in the epoll instance
+    bool always_ready;      // The descriptor cannot be watched (regular files)
+};
+
+// ============================================================================
+//                      Local prototypes
+// ============================================================================
+static int wait_ready( dmdevfs_hostdev_file_t* file, uint32_t events, int timeout_ms );
+static int get_access_flags( int mode );
+
+// ============================================================================
+//                      Public functions
+// ============================================================================
+
+/**
+ * @brief Create a host device
+ */
+dmdevfs_hostdev_t* dmdevfs_hostdev_create( const char* name, const char* path )
+{
+    dmdevfs_hostdev_t* hostdev = Dmod_Malloc(sizeof(dmdevfs_hostdev_t));
+    if(hostdev == NULL)
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for host device: %s\n", path);
+        return NULL;
+    }
+    strncpy(hostdev->name, name, sizeof(hostdev->name));
+    hostdev->name[sizeof(hostdev->name) - 1] = '\0';
+    hostdev->path = Dmod_StrDup(path);
+    if(hostdev->path == NULL)
+    {
+        Dmod_Free(hostdev);
+        return NULL;
+    }
+    DMOD_LOG_INFO("Configured host device: %s (path: %s)\n", name, path);
+    return hostdev;
+}
+
+/**
+ * @brief Destroy a host device
+ */
+void dmdevfs_hostdev_destroy( dmdevfs_hostdev_t* hostdev )
+{
+    if(hostdev != NULL)
+    {
+        Dmod_Free(hostdev->path);
+        Dmod_Free(hostdev);
+    }
+}
+
+/**
+ * @brief Get the name of the node of a host device
+ */
+const char* dmdevfs_hostdev_name( const dmdevfs_hostdev_t* hostdev )
+{
+    return hostdev->name;
+}
+
+/**
+ * @brief Get the size of a host device
+ */
+int dmdevfs_hostdev_stat( const dmdevfs_hostdev_t* hostdev, uint32_t* size )
+{
+    struct stat st;
+    if(stat(hostdev->path, &st) != 0)
+    {
+        return -1;
+    }
+    *size = S_ISREG(st.st_mode) ? (uint32_t)st.st_size : 0;
+    return 0;
+}
+
+/**
+ * @brief Open a host device
+ */
+dmdevfs_hostdev_file_t* dmdevfs_hostdev_open( dmdevfs_hostdev_t* hostdev, int mode )
+{
+    dmdevfs_hostdev_file_t* file = Dmod_Malloc(sizeof(dmdevfs_hostdev_file_t));
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    file->interest = 0;
+    file->always_ready = false;
+    file->fd = open(hostdev->path, get_access_flags(mode) | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(file->fd < 0)
+    {
+        DMOD_LOG_ERROR("Failed to open host device %s: %s\n", hostdev->path, strerror(errno));
+        Dmod_Free(file);
+        return NULL;
+    }
+    file->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(file->epoll_fd < 0)
+    {
+        DMOD_LOG_ERROR("Failed to create epoll instance: %s\n", strerror(errno));
+        close(file->fd);
+        Dmod_Free(file);
+        return NULL;
+    }
+
+    struct epoll_event event = { .events = 0, .data.ptr = file };
+    if(epoll_ctl(file->epoll_fd, EPOLL_CTL_ADD, file->fd, &event) != 0)
+    {
+        // Regular files cannot be watched, but never block either
+        file->always_ready = (errno == EPERM);
+        if(!file->always_ready)
+        {
+            DMOD_LOG_ERROR("Failed to watch host device %s: %s\n", hostdev->path, strerror(errno));
+            close(file->epoll_fd);
+            close(file->fd);
+            Dmod_Free(file);
+            return NULL;
+        }
+    }
+    return file;
+}
+
+/**
+ * @brief Close a host device
+ */
+void dmdevfs_hostdev_close( dmdevfs_hostdev_file_t* file )
+{
+    if(file != NULL)
+    {
+        close(file->epoll_fd);
+        close(file->fd);
+        Dmod_Free(file);
+    }
+}
+
+/**
+ * @brief Read from a host device, waiting until at least one byte is available
+ */
+size_t dmdevfs_hostdev_read( dmdevfs_hostdev_file_t* file, void* buffer, size_t size )
+{
+    while(size > 0)
+    {
+        ssize_t result = read(file->fd, buffer, size);
+        if(result >= 0)
+        {
+            return (size_t)result;
+        }
+        if(errno != EAGAIN && errno != EINTR)
+        {
+            return 0;
+        }
+        if(errno == EAGAIN && wait_ready(file, EPOLLIN, -1) <= 0)
+        {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Write to a host device, waiting until the whole buffer is accepted
+ */
+size_t dmdevfs_hostdev_write( dmdevfs_hostdev_file_t* file, const void* buffer, size_t size )
+{
+    size_t written = 0;
+    while(written < size)
+    {
+        ssize_t result = write(file->fd, (const uint8_t*)buffer + written, size - written);
+        if(result >= 0)
+        {
+            written += (size_t)result;
+            continue;
+        }
+        if(errno != EAGAIN && errno != EINTR)
+        {
+            break;
+        }
+        if(errno == EAGAIN && wait_ready(file, EPOLLOUT, -1) <= 0)
+        {
+            break;
+        }
+    }
+    return written;
+}
+
+/**
+ * @brief Wait until the output of a host device is transmitted
+ */
+int dmdevfs_hostdev_flush( dmdevfs_hostdev_file_t* file )
+{
+    if(isatty(file->fd))
+    {
+        return tcdrain(file->fd);
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a control command to a host device
+ */
+int dmdevfs_hostdev_ioctl( dmdevfs_hostdev_file_t* file, int command, void* arg )
+{
+    return ioctl(file->fd, (unsigned long)(unsigned)command, arg);
+}
+
+/**
+ * @brief Wait until a host device is ready
+ */
+int dmdevfs_hostdev_poll( dmdevfs_hostdev_file_t* file, int events, int timeout_ms )
+{
+    uint32_t interest = 0;
+    if(events & DMDEVFS_POLL_IN)  interest |= EPOLLIN;
+    if(events & DMDEVFS_POLL_OUT) interest |= EPOLLOUT;
+
+    int ready = wait_ready(file, interest, timeout_ms);
+    if(ready < 0)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    if(ready & EPOLLIN)             result |= DMDEVFS_POLL_IN;
+    if(ready & EPOLLOUT)            result |= DMDEVFS_POLL_OUT;
+    if(ready & (EPOLLERR | EPOLLHUP)) result |= DMDEVFS_POLL_ERR;
+    return result;
+}
+
+// ============================================================================
+//                      Local functions
+// ============================================================================
+
+/**
+ * @brief Get the open(2) access mode of a DMFSI open mode
+ */
+static int get_access_flags( int mode )
+{
+    if((mode & DMFSI_O_RDWR) == DMFSI_O_RDWR)
+    {
+        return O_RDWR;
+    }
+    if((mode & DMFSI_O_WRONLY) == DMFSI_O_WRONLY)
+    {
+        return O_WRONLY;
+    }
+    return O_RDONLY;
+}
+
+/**
+ * @brief Wait for events on the descriptor of a file
+ * @return Ready epoll events, 0 on timeout, negative on error
+ */
+static int wait_ready( dmdevfs_hostdev_file_t* file, uint32_t events, int timeout_ms )
+{
+    if(file->always_ready)
+    {
+        return (int)events;
+    }
+
+    if(file->interest != events)
+    {
+        struct epoll_event event = { .events = events, .data.ptr = file };
+        if(epoll_ctl(file->epoll_fd, EPOLL_CTL_MOD, file->fd, &event) != 0)
+        {
+            return -1;
+        }
+        file->interest = events;
+    }
+
+    struct epoll_event ready;
+    int count;
+    do
+    {
+        count = epoll_wait(file->epoll_fd, &ready, 1, timeout_ms);
+    } while(count < 0 && errno == EINTR);
+
+    if(count <= 0)
+    {
+        return count;
+    }
+    return (int)ready.events;
+}
+
+#endif // DMDEVFS_ENABLE_HOSTDEV
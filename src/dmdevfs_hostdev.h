@@ -0,0 +1,93 @@
+/**
+ * @file dmdevfs_hostdev.h
+ * @brief DMOD Driver File System - Linux host device backend
+ * @author Patryk Kubiak
+ *
+ * Maps a dmdevfs node to a Linux character device, pipe or pty instead of a
+ * DMOD driver module, so applications can run against real kernel objects
+ * (e.g. pty-based device simulators) on a Linux host.
+ *
+ * Configuration:
+ * [main]
+ * type = hostdev
+ * path = /dev/pts/3
+ *
+ * The backend is built only when DMDEVFS_ENABLE_HOSTDEV is defined. Otherwise
+ * the functions below are stubs and no node can use the backend.
+ */
+
+#ifndef DMDEVFS_HOSTDEV_H
+#define DMDEVFS_HOSTDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Host device of a node
+ */
+typedef struct dmdevfs_hostdev dmdevfs_hostdev_t;
+
+/**
+ * @brief Host device opened by a file
+ */
+typedef struct dmdevfs_hostdev_file dmdevfs_hostdev_file_t;
+
+#ifdef DMDEVFS_ENABLE_HOSTDEV
+
+/**
+ * @brief Create a host device
+ * @param name Name of the node in the file system
+ * @param path Path of the host device (e.g. /dev/pts/3)
+ */
+dmdevfs_hostdev_t* dmdevfs_hostdev_create( const char* name, const char* path );
+void dmdevfs_hostdev_destroy( dmdevfs_hostdev_t* hostdev );
+const char* dmdevfs_hostdev_name( const dmdevfs_hostdev_t* hostdev );
+
+/**
+ * @brief Get the size of a host device (0 for character devices, pipes and ptys)
+ */
+int dmdevfs_hostdev_stat( const dmdevfs_hostdev_t* hostdev, uint32_t* size );
+
+/**
+ * @brief Open a host device with the access mode (DMFSI_O_*) of the file
+ *
+ * The descriptor is always non-blocking and registered in an epoll instance of
+ * the file; blocking reads and writes wait for readiness through epoll.
+ */
+dmdevfs_hostdev_file_t* dmdevfs_hostdev_open( dmdevfs_hostdev_t* hostdev, int mode );
+void dmdevfs_hostdev_close( dmdevfs_hostdev_file_t* file );
+size_t dmdevfs_hostdev_read( dmdevfs_hostdev_file_t* file, void* buffer, size_t size );
+size_t dmdevfs_hostdev_write( dmdevfs_hostdev_file_t* file, const void* buffer, size_t size );
+int dmdevfs_hostdev_flush( dmdevfs_hostdev_file_t* file );
+
+/**
+ * @brief Send a control command to a host device with ioctl(2)
+ * @return Value returned by ioctl(2) (-1 on error)
+ */
+int dmdevfs_hostdev_ioctl( dmdevfs_hostdev_file_t* file, int command, void* arg );
+
+/**
+ * @brief Wait until a host device is ready
+ * @param events DMDEVFS_POLL_* events to wait for
+ * @param timeout_ms Maximum time to wait (0 - do not wait, negative - forever)
+ * @return Ready DMDEVFS_POLL_* events (0 on timeout), negative on error
+ */
+int dmdevfs_hostdev_poll( dmdevfs_hostdev_file_t* file, int events, int timeout_ms );
+
+#else
+
+static inline void dmdevfs_hostdev_destroy( dmdevfs_hostdev_t* hostdev ) { (void)hostdev; }
+static inline const char* dmdevfs_hostdev_name( const dmdevfs_hostdev_t* hostdev ) { (void)hostdev; return NULL; }
+static inline int dmdevfs_hostdev_stat( const dmdevfs_hostdev_t* hostdev, uint32_t* size ) { (void)hostdev; (void)size; return -1; }
+static inline dmdevfs_hostdev_file_t* dmdevfs_hostdev_open( dmdevfs_hostdev_t* hostdev, int mode ) { (void)hostdev; (void)mode; return NULL; }
+static inline void dmdevfs_hostdev_close( dmdevfs_hostdev_file_t* file ) { (void)file; }
+static inline size_t dmdevfs_hostdev_read( dmdevfs_hostdev_file_t* file, void* buffer, size_t size ) { (void)file; (void)buffer; (void)size; return 0; }
+static inline size_t dmdevfs_hostdev_write( dmdevfs_hostdev_file_t* file, const void* buffer, size_t size ) { (void)file; (void)buffer; (void)size; return 0; }
+static inline int dmdevfs_hostdev_flush( dmdevfs_hostdev_file_t* file ) { (void)file; return -1; }
+static inline int dmdevfs_hostdev_ioctl( dmdevfs_hostdev_file_t* file, int command, void* arg ) { (void)file; (void)command; (void)arg; return -1; }
+static inline int dmdevfs_hostdev_poll( dmdevfs_hostdev_file_t* file, int events, int timeout_ms ) { (void)file; (void)events; (void)timeout_ms; return -1; }
+
+#endif // DMDEVFS_ENABLE_HOSTDEV
+
+#endif // DMDEVFS_HOSTDEV_H
@@ -0,0 +1,844 @@
+/**
+ * @file dmdevfs_kernels.c
+ * @brief DMOD Driver File System - Bulk data processing kernels
+ * @author Patryk Kubiak
+ *
+ * Every vectorized kernel processes the bulk of the data and leaves the tail
+ * (and anything it cannot load safely) to the portable implementation. Integer
+ * results are identical regardless of the selected variant; floating-point
+ * reductions may differ in rounding because the summation order differs.
+ */
+
+#include "dmdevfs_kernels.h"
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define DMDEVFS_KERNELS_AVX2     1
+#   define DMDEVFS_KERNELS_SSSE3    1
+#elif defined(__SSSE3__)
+#   include <tmmintrin.h>
+#   define DMDEVFS_KERNELS_SSSE3    1
+#elif defined(__ARM_NEON) && defined(__aarch64__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#   include <arm_neon.h>
+#   define DMDEVFS_KERNELS_NEON     1
+#endif
+
+#if defined(DMDEVFS_KERNELS_SSSE3) || defined(DMDEVFS_KERNELS_NEON)
+#   define DMDEVFS_KERNELS_VECTOR   1
+#endif
+
+/**
+ * @brief Scale of a left-aligned 32-bit sample to the [-1.0, 1.0) range
+ */
+#define LEFT_ALIGNED_TO_FLOAT   (1.0f / 2147483648.0f)
+
+/**
+ * @brief Layout of a packed integer sample
+ */
+typedef struct
+{
+    size_t bytes;       // Size of the sample in bytes
+    bool big_endian;    // Byte order of the sample
+} packed_layout_t;
+
+// ============================================================================
+//                      Local prototypes
+// ============================================================================
+static bool read_packed_layout( dmdevfs_sample_format_t format, packed_layout_t* layout );
+#if defined(DMDEVFS_KERNELS_VECTOR)
+static void build_shuffle_mask( const packed_layout_t* layout, uint8_t mask[16] );
+#endif
+static size_t convert_packed_vector( const packed_layout_t* layout, const uint8_t* source, bool to_float, void* target, size_t count );
+static void convert_packed_scalar( const packed_layout_t* layout, const uint8_t* source, bool to_float, void* target, size_t count );
+static size_t get_span( size_t count, size_t stride );
+#if defined(DMDEVFS_KERNELS_VECTOR)
+static int64_t add_lanes_s64( const int64_t* lanes, size_t count, size_t stride );
+static double add_lanes_f64( const double* lanes, size_t count, size_t stride );
+static int32_t select_lanes_s32( const int32_t* lanes, size_t count, size_t stride, bool maximum, int32_t extreme );
+static float select_lanes_f32( const float* lanes, size_t count, size_t stride, bool maximum, float extreme );
+#endif
+static size_t sum_s32_vector( const int32_t* samples, size_t count, size_t stride, int64_t* sum );
+static size_t sum_f32_vector( const float* samples, size_t count, size_t stride, double* sum );
+static size_t extreme_s32_vector( const int32_t* samples, size_t count, size_t stride, bool maximum, int32_t* extreme );
+static size_t extreme_f32_vector( const float* samples, size_t count, size_t stride, bool maximum, float* extreme );
+static size_t dot_f32_vector( const float* a, const float* b, size_t count, float* dot );
+static size_t compare_bytes_vector( const uint8_t* a, const uint8_t* b, size_t size );
+
+// ============================================================================
+//                      Public functions
+// ============================================================================
+
+/**
+ * @brief Parse a sample format name
+ */
+dmdevfs_sample_format_t dmdevfs_parse_sample_format( const char* name )
+{
+    static const struct
+    {
+        const char* name;
+        dmdevfs_sample_format_t format;
+    } formats[] = {
+        { "s16le", DMDEVFS_SAMPLE_S16LE },
+        { "s16be", DMDEVFS_SAMPLE_S16BE },
+        { "s24le", DMDEVFS_SAMPLE_S24LE },
+        { "s24be", DMDEVFS_SAMPLE_S24BE },
+        { "s32le", DMDEVFS_SAMPLE_S32LE },
+        { "s32be", DMDEVFS_SAMPLE_S32BE },
+        { "s32",   DMDEVFS_SAMPLE_S32   },
+        { "f32",   DMDEVFS_SAMPLE_F32   },
+    };
+
+    if(name == NULL)
+    {
+        return DMDEVFS_SAMPLE_NONE;
+    }
+    for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if(strcmp(formats[i].name, name) == 0)
+        {
+            return formats[i].format;
+        }
+    }
+    return DMDEVFS_SAMPLE_NONE;
+}
+
+/**
+ * @brief Get the size of a single sample in bytes
+ */
+size_t dmdevfs_sample_size( dmdevfs_sample_format_t format )
+{
+    switch(format)
+    {
+        case DMDEVFS_SAMPLE_S16LE:
+        case DMDEVFS_SAMPLE_S16BE:
+            return 2;
+        case DMDEVFS_SAMPLE_S24LE:
+        case DMDEVFS_SAMPLE_S24BE:
+            return 3;
+        case DMDEVFS_SAMPLE_S32LE:
+        case DMDEVFS_SAMPLE_S32BE:
+        case DMDEVFS_SAMPLE_S32:
+        case DMDEVFS_SAMPLE_F32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Convert packed samples to a native format
+ */
+void dmdevfs_convert_samples( dmdevfs_sample_format_t source_format, const uint8_t* source,
+                              dmdevfs_sample_format_t target_format, void* target, size_t count )
+{
+    if(source_format == target_format)
+    {
+        memcpy(target, source, count * dmdevfs_sample_size(source_format));
+        return;
+    }
+
+    bool to_float = (target_format == DMDEVFS_SAMPLE_F32);
+    if(source_format == DMDEVFS_SAMPLE_F32)
+    {
+        // Float to integer - only used for completeness, no vector variant
+        for(size_t i = 0; i < count; i++)
+        {
+            float value;
+            memcpy(&value, source + i * sizeof(float), sizeof(float));
+            float scaled = value * 2147483648.0f;
+            int32_t sample = scaled >= 2147483647.0f  ? INT32_MAX :
+                             scaled <= -2147483648.0f ? INT32_MIN : (int32_t)scaled;
+            memcpy((uint8_t*)target + i * sizeof(int32_t), &sample, sizeof(sample));
+        }
+        return;
+    }
+
+    packed_layout_t layout;
+    if(!read_packed_layout(source_format, &layout))
+    {
+        return;
+    }
+
+    size_t done = convert_packed_vector(&layout, source, to_float, target, count);
+    if(done < count)
+    {
+        // Both targets are 32 bits wide
+        void* tail = (uint8_t*)target + done * sizeof(int32_t);
+        convert_packed_scalar(&layout, source + done * layout.bytes, to_float, tail, count - done);
+    }
+}
+
+/**
+ * @brief Sum every stride-th sample
+ */
+int64_t dmdevfs_sum_s32( const int32_t* samples, size_t count, size_t stride )
+{
+    int64_t sum = 0;
+    size_t done = sum_s32_vector(samples, count, stride, &sum);
+    for(size_t i = done; i < count; i++)
+    {
+        sum += samples[i * stride];
+    }
+    return sum;
+}
+
+/**
+ * @brief Sum every stride-th sample
+ */
+double dmdevfs_sum_f32( const float* samples, size_t count, size_t stride )
+{
+    // Accumulated in double precision, which keeps long blocks accurate
+    double sum = 0.0;
+    size_t done = sum_f32_vector(samples, count, stride, &sum);
+    for(size_t i = done; i < count; i++)
+    {
+        sum += samples[i * stride];
+    }
+    return sum;
+}
+
+/**
+ * @brief Find the minimum or maximum of every stride-th sample
+ */
+int32_t dmdevfs_extreme_s32( const int32_t* samples, size_t count, size_t stride, bool maximum, int32_t initial )
+{
+    int32_t extreme = initial;
+    size_t done = extreme_s32_vector(samples, count, stride, maximum, &extreme);
+    for(size_t i = done; i < count; i++)
+    {
+        int32_t value = samples[i * stride];
+        if(maximum ? (value > extreme) : (value < extreme))
+        {
+            extreme = value;
+        }
+    }
+    return extreme;
+}
+
+/**
+ * @brief Find the minimum or maximum of every stride-th sample
+ */
+float dmdevfs_extreme_f32( const float* samples, size_t count, size_t stride, bool maximum, float initial )
+{
+    float extreme = initial;
+    size_t done = extreme_f32_vector(samples, count, stride, maximum, &extreme);
+    for(size_t i = done; i < count; i++)
+    {
+        float value = samples[i * stride];
+        if(maximum ? (value > extreme) : (value < extreme))
+        {
+            extreme = value;
+        }
+    }
+    return extreme;
+}
+
+/**
+ * @brief Compute the dot product of two vectors
+ */
+float dmdevfs_dot_f32( const float* a, const float* b, size_t count )
+{
+    float dot = 0.0f;
+    size_t done = dot_f32_vector(a, b, count, &dot);
+    for(size_t i = done; i < count; i++)
+    {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+/**
+ * @brief Find the first byte that differs between two buffers
+ */
+size_t dmdevfs_compare_bytes( const void* a, const void* b, size_t size )
+{
+    const uint8_t* bytes_a = a;
+    const uint8_t* bytes_b = b;
+    size_t offset = compare_bytes_vector(bytes_a, bytes_b, size);
+    while(offset < size && bytes_a[offset] == bytes_b[offset])
+    {
+        offset++;
+    }
+    return offset;
+}
+
+// ============================================================================
+//                      Local functions
+// ============================================================================
+
+/**
+ * @brief Read the layout of a packed integer format
+ */
+static bool read_packed_layout( dmdevfs_sample_format_t format, packed_layout_t* layout )
+{
+    layout->bytes = dmdevfs_sample_size(format);
+    switch(format)
+    {
+        case DMDEVFS_SAMPLE_S16LE:
+        case DMDEVFS_SAMPLE_S24LE:
+        case DMDEVFS_SAMPLE_S32LE:
+            layout->big_endian = false;
+            return true;
+        case DMDEVFS_SAMPLE_S16BE:
+        case DMDEVFS_SAMPLE_S24BE:
+        case DMDEVFS_SAMPLE_S32BE:
+            layout->big_endian = true;
+            return true;
+        case DMDEVFS_SAMPLE_S32:
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+            layout->big_endian = true;
+#else
+            layout->big_endian = false;
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+#if defined(DMDEVFS_KERNELS_VECTOR)
+/**
+ * @brief Build a byte shuffle that places 4 packed samples in the top of 32-bit lanes
+ *
+ * Lane bytes that have no source are set to 0x80, which both SSSE3 and NEON
+ * table lookups turn into zero.
+ */
+static void build_shuffle_mask( const packed_layout_t* layout, uint8_t mask[16] )
+{
+    memset(mask, 0x80, 16);
+    for(size_t lane = 0; lane < 4; lane++)
+    {
+        for(size_t k = 0; k < layout->bytes; k++)
+        {
+            // k is the significance of the byte, 0 being the most significant
+            size_t source_index = lane * layout->bytes + (layout->big_endian ? k : layout->bytes - 1 - k);
+            mask[lane * 4 + 3 - k] = (uint8_t)source_index;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Convert the bulk of the samples with the vector unit
+ * @return Number of samples converted
+ */
+static size_t convert_packed_vector( const packed_layout_t* layout, const uint8_t* source, bool to_float, void* target, size_t count )
+{
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_VECTOR)
+    uint8_t mask_bytes[16];
+    build_shuffle_mask(layout, mask_bytes);
+    int shift = (int)(32 - 8 * layout->bytes);
+    uint8_t* output = target;   // Stored with unaligned stores only
+#else
+    (void)layout; (void)source; (void)to_float; (void)target; (void)count;
+#endif
+
+#if defined(DMDEVFS_KERNELS_AVX2)
+    {
+        __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)mask_bytes));
+        __m128i shift_count = _mm_cvtsi32_si128(shift);
+        __m256 scale = _mm256_set1_ps(LEFT_ALIGNED_TO_FLOAT);
+        // Both 16-byte loads must stay inside the input
+        while(count - done >= 8 && (count - done - 4) * layout->bytes >= 16)
+        {
+            const uint8_t* input = source + done * layout->bytes;
+            __m128i low = _mm_loadu_si128((const __m128i*)input);
+            __m128i high = _mm_loadu_si128((const __m128i*)(input + 4 * layout->bytes));
+            __m256i value = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), mask);
+            if(to_float)
+            {
+                _mm256_storeu_ps((float*)(output + done * sizeof(float)), _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale));
+            }
+            else
+            {
+                _mm256_storeu_si256((__m256i*)(output + done * sizeof(int32_t)), _mm256_sra_epi32(value, shift_count));
+            }
+            done += 8;
+        }
+    }
+#endif
+
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    {
+        __m128i mask = _mm_loadu_si128((const __m128i*)mask_bytes);
+        __m128i shift_count = _mm_cvtsi32_si128(shift);
+        __m128 scale = _mm_set1_ps(LEFT_ALIGNED_TO_FLOAT);
+        // The load is 16 bytes wide even when 4 samples take less
+        while(count - done >= 4 && (count - done) * layout->bytes >= 16)
+        {
+            __m128i raw = _mm_loadu_si128((const __m128i*)(source + done * layout->bytes));
+            __m128i value = _mm_shuffle_epi8(raw, mask);
+            if(to_float)
+            {
+                _mm_storeu_ps((float*)(output + done * sizeof(float)), _mm_mul_ps(_mm_cvtepi32_ps(value), scale));
+            }
+            else
+            {
+                _mm_storeu_si128((__m128i*)(output + done * sizeof(int32_t)), _mm_sra_epi32(value, shift_count));
+            }
+            done += 4;
+        }
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    {
+        uint8x16_t mask = vld1q_u8(mask_bytes);
+        int32x4_t shift_count = vdupq_n_s32(-shift);
+        // The load is 16 bytes wide even when 4 samples take less
+        while(count - done >= 4 && (count - done) * layout->bytes >= 16)
+        {
+            uint8x16_t raw = vld1q_u8(source + done * layout->bytes);
+            int32x4_t value = vreinterpretq_s32_u8(vqtbl1q_u8(raw, mask));
+            if(to_float)
+            {
+                vst1q_f32((float*)(output + done * sizeof(float)), vmulq_n_f32(vcvtq_f32_s32(value), LEFT_ALIGNED_TO_FLOAT));
+            }
+            else
+            {
+                vst1q_s32((int32_t*)(output + done * sizeof(int32_t)), vshlq_s32(value, shift_count));
+            }
+            done += 4;
+        }
+    }
+#endif
+    return done;
+}
+
+/**
+ * @brief Convert samples one at a time
+ *
+ * The target may have any alignment, so every sample is stored with memcpy.
+ */
+static void convert_packed_scalar( const packed_layout_t* layout, const uint8_t* source, bool to_float, void* target, size_t count )
+{
+    int shift = (int)(32 - 8 * layout->bytes);
+    uint8_t* output = target;
+    for(size_t i = 0; i < count; i++)
+    {
+        const uint8_t* input = source + i * layout->bytes;
+        uint32_t value = 0;
+        for(size_t k = 0; k < layout->bytes; k++)
+        {
+            uint8_t byte = layout->big_endian ? input[k] : input[layout->bytes - 1 - k];
+            value |= (uint32_t)byte << (24 - 8 * k);
+        }
+        if(to_float)
+        {
+            float sample = (float)(int32_t)value * LEFT_ALIGNED_TO_FLOAT;
+            memcpy(output + i * sizeof(float), &sample, sizeof(sample));
+        }
+        else
+        {
+            int32_t sample = (int32_t)value >> shift;
+            memcpy(output + i * sizeof(int32_t), &sample, sizeof(sample));
+        }
+    }
+}
+
+/**
+ * @brief Get the number of elements from the first to the last of @p count samples @p stride apart
+ *
+ * Only these elements may be loaded: the elements after the last sample belong
+ * to other channels that the buffer does not necessarily hold.
+ */
+static size_t get_span( size_t count, size_t stride )
+{
+    return (count > 0 && stride > 0) ? (count - 1) * stride + 1 : 0;
+}
+
+#if defined(DMDEVFS_KERNELS_VECTOR)
+/**
+ * @brief Add the lanes of vector accumulators that hold samples of the channel
+ *
+ * Vectors are loaded from offsets that are multiples of the vector width, so
+ * lane i holds a sample of the channel when i is a multiple of the stride.
+ */
+static int64_t add_lanes_s64( const int64_t* lanes, size_t count, size_t stride )
+{
+    int64_t sum = 0;
+    for(size_t i = 0; i < count; i += stride)
+    {
+        sum += lanes[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Add the lanes of vector accumulators that hold samples of the channel
+ */
+static double add_lanes_f64( const double* lanes, size_t count, size_t stride )
+{
+    double sum = 0.0;
+    for(size_t i = 0; i < count; i += stride)
+    {
+        sum += lanes[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Merge the lanes of a vector minimum/maximum that hold samples of the channel
+ */
+static int32_t select_lanes_s32( const int32_t* lanes, size_t count, size_t stride, bool maximum, int32_t extreme )
+{
+    for(size_t i = 0; i < count; i += stride)
+    {
+        extreme = (maximum ? (lanes[i] > extreme) : (lanes[i] < extreme)) ? lanes[i] : extreme;
+    }
+    return extreme;
+}
+
+/**
+ * @brief Merge the lanes of a vector minimum/maximum that hold samples of the channel
+ */
+static float select_lanes_f32( const float* lanes, size_t count, size_t stride, bool maximum, float extreme )
+{
+    for(size_t i = 0; i < count; i += stride)
+    {
+        extreme = (maximum ? (lanes[i] > extreme) : (lanes[i] < extreme)) ? lanes[i] : extreme;
+    }
+    return extreme;
+}
+#endif
+
+/**
+ * @brief Sum the bulk of every stride-th sample with the vector unit
+ *
+ * Interleaved channels are loaded whole and every lane is accumulated; only the
+ * lanes of the channel are added up at the end. This works for strides that
+ * divide the vector width (1, 2 and 4 channels, and 8 with AVX2).
+ *
+ * @return Number of samples added to @p sum
+ */
+static size_t sum_s32_vector( const int32_t* samples, size_t count, size_t stride, int64_t* sum )
+{
+    size_t span = get_span(count, stride);
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    if(span >= 8 && 8 % stride == 0)
+    {
+        // Elements 0-3 and 4-7 of each vector are widened into separate accumulators
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        for(; span - done >= 8; done += 8)
+        {
+            __m256i value = _mm256_loadu_si256((const __m256i*)(samples + done));
+            low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(value)));
+            high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(value, 1)));
+        }
+        int64_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, low);
+        _mm256_storeu_si256((__m256i*)(lanes + 4), high);
+        *sum += add_lanes_s64(lanes, 8, stride);
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    if(span - done >= 4 && 4 % stride == 0)
+    {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        for(; span - done >= 4; done += 4)
+        {
+            __m128i value = _mm_loadu_si128((const __m128i*)(samples + done));
+            __m128i sign = _mm_srai_epi32(value, 31);
+            low = _mm_add_epi64(low, _mm_unpacklo_epi32(value, sign));
+            high = _mm_add_epi64(high, _mm_unpackhi_epi32(value, sign));
+        }
+        int64_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, low);
+        _mm_storeu_si128((__m128i*)(lanes + 2), high);
+        *sum += add_lanes_s64(lanes, 4, stride);
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    if(span >= 4 && 4 % stride == 0)
+    {
+        int64x2_t low = vdupq_n_s64(0);
+        int64x2_t high = vdupq_n_s64(0);
+        for(; span - done >= 4; done += 4)
+        {
+            int32x4_t value = vld1q_s32(samples + done);
+            low = vaddw_s32(low, vget_low_s32(value));
+            high = vaddw_high_s32(high, value);
+        }
+        int64_t lanes[4];
+        vst1q_s64(lanes, low);
+        vst1q_s64(lanes + 2, high);
+        *sum += add_lanes_s64(lanes, 4, stride);
+    }
+#else
+    (void)samples; (void)span; (void)sum;
+#endif
+    return (done > 0) ? done / stride : 0;
+}
+
+/**
+ * @brief Sum the bulk of every stride-th sample with the vector unit, in double precision
+ * @return Number of samples added to @p sum
+ */
+static size_t sum_f32_vector( const float* samples, size_t count, size_t stride, double* sum )
+{
+    size_t span = get_span(count, stride);
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    if(span >= 8 && 8 % stride == 0)
+    {
+        __m256d low = _mm256_setzero_pd();
+        __m256d high = _mm256_setzero_pd();
+        for(; span - done >= 8; done += 8)
+        {
+            __m256 value = _mm256_loadu_ps(samples + done);
+            low = _mm256_add_pd(low, _mm256_cvtps_pd(_mm256_castps256_ps128(value)));
+            high = _mm256_add_pd(high, _mm256_cvtps_pd(_mm256_extractf128_ps(value, 1)));
+        }
+        double lanes[8];
+        _mm256_storeu_pd(lanes, low);
+        _mm256_storeu_pd(lanes + 4, high);
+        *sum += add_lanes_f64(lanes, 8, stride);
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    if(span - done >= 4 && 4 % stride == 0)
+    {
+        __m128d low = _mm_setzero_pd();
+        __m128d high = _mm_setzero_pd();
+        for(; span - done >= 4; done += 4)
+        {
+            __m128 value = _mm_loadu_ps(samples + done);
+            low = _mm_add_pd(low, _mm_cvtps_pd(value));
+            high = _mm_add_pd(high, _mm_cvtps_pd(_mm_movehl_ps(value, value)));
+        }
+        double lanes[4];
+        _mm_storeu_pd(lanes, low);
+        _mm_storeu_pd(lanes + 2, high);
+        *sum += add_lanes_f64(lanes, 4, stride);
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    if(span >= 4 && 4 % stride == 0)
+    {
+        float64x2_t low = vdupq_n_f64(0.0);
+        float64x2_t high = vdupq_n_f64(0.0);
+        for(; span - done >= 4; done += 4)
+        {
+            float32x4_t value = vld1q_f32(samples + done);
+            low = vaddq_f64(low, vcvt_f64_f32(vget_low_f32(value)));
+            high = vaddq_f64(high, vcvt_high_f64_f32(value));
+        }
+        double lanes[4];
+        vst1q_f64(lanes, low);
+        vst1q_f64(lanes + 2, high);
+        *sum += add_lanes_f64(lanes, 4, stride);
+    }
+#else
+    (void)samples; (void)span; (void)sum;
+#endif
+    return (done > 0) ? done / stride : 0;
+}
+
+/**
+ * @brief Find the extreme of the bulk of every stride-th sample with the vector unit
+ *
+ * Lanes that hold other channels are compared as well but ignored at the end.
+ *
+ * @return Number of samples taken into account in @p extreme
+ */
+static size_t extreme_s32_vector( const int32_t* samples, size_t count, size_t stride, bool maximum, int32_t* extreme )
+{
+    size_t span = get_span(count, stride);
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    if(span >= 8 && 8 % stride == 0)
+    {
+        __m256i result = _mm256_set1_epi32(*extreme);
+        for(; span - done >= 8; done += 8)
+        {
+            __m256i value = _mm256_loadu_si256((const __m256i*)(samples + done));
+            result = maximum ? _mm256_max_epi32(result, value) : _mm256_min_epi32(result, value);
+        }
+        int32_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, result);
+        *extreme = select_lanes_s32(lanes, 8, stride, maximum, *extreme);
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    if(span - done >= 4 && 4 % stride == 0)
+    {
+        // SSE2 has no 32-bit min/max, so select through a compare mask
+        __m128i result = _mm_set1_epi32(*extreme);
+        for(; span - done >= 4; done += 4)
+        {
+            __m128i value = _mm_loadu_si128((const __m128i*)(samples + done));
+            __m128i take = maximum ? _mm_cmpgt_epi32(value, result) : _mm_cmplt_epi32(value, result);
+            result = _mm_or_si128(_mm_and_si128(take, value), _mm_andnot_si128(take, result));
+        }
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, result);
+        *extreme = select_lanes_s32(lanes, 4, stride, maximum, *extreme);
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    if(span >= 4 && 4 % stride == 0)
+    {
+        int32x4_t result = vdupq_n_s32(*extreme);
+        for(; span - done >= 4; done += 4)
+        {
+            int32x4_t value = vld1q_s32(samples + done);
+            result = maximum ? vmaxq_s32(result, value) : vminq_s32(result, value);
+        }
+        int32_t lanes[4];
+        vst1q_s32(lanes, result);
+        *extreme = select_lanes_s32(lanes, 4, stride, maximum, *extreme);
+    }
+#else
+    (void)samples; (void)span; (void)maximum; (void)extreme;
+#endif
+    return (done > 0) ? done / stride : 0;
+}
+
+/**
+ * @brief Find the extreme of the bulk of every stride-th sample with the vector unit
+ * @return Number of samples taken into account in @p extreme
+ */
+static size_t extreme_f32_vector( const float* samples, size_t count, size_t stride, bool maximum, float* extreme )
+{
+    size_t span = get_span(count, stride);
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    if(span >= 8 && 8 % stride == 0)
+    {
+        __m256 result = _mm256_set1_ps(*extreme);
+        for(; span - done >= 8; done += 8)
+        {
+            __m256 value = _mm256_loadu_ps(samples + done);
+            result = maximum ? _mm256_max_ps(result, value) : _mm256_min_ps(result, value);
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, result);
+        *extreme = select_lanes_f32(lanes, 8, stride, maximum, *extreme);
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    if(span - done >= 4 && 4 % stride == 0)
+    {
+        __m128 result = _mm_set1_ps(*extreme);
+        for(; span - done >= 4; done += 4)
+        {
+            __m128 value = _mm_loadu_ps(samples + done);
+            result = maximum ? _mm_max_ps(result, value) : _mm_min_ps(result, value);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, result);
+        *extreme = select_lanes_f32(lanes, 4, stride, maximum, *extreme);
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    if(span >= 4 && 4 % stride == 0)
+    {
+        float32x4_t result = vdupq_n_f32(*extreme);
+        for(; span - done >= 4; done += 4)
+        {
+            float32x4_t value = vld1q_f32(samples + done);
+            result = maximum ? vmaxq_f32(result, value) : vminq_f32(result, value);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, result);
+        *extreme = select_lanes_f32(lanes, 4, stride, maximum, *extreme);
+    }
+#else
+    (void)samples; (void)span; (void)maximum; (void)extreme;
+#endif
+    return (done > 0) ? done / stride : 0;
+}
+
+/**
+ * @brief Compute the dot product of the bulk of two vectors with the vector unit
+ * @return Number of elements added to @p dot
+ */
+static size_t dot_f32_vector( const float* a, const float* b, size_t count, float* dot )
+{
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    if(count - done >= 8)
+    {
+        __m256 accumulator = _mm256_setzero_ps();
+        for(; count - done >= 8; done += 8)
+        {
+            accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(_mm256_loadu_ps(a + done), _mm256_loadu_ps(b + done)));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, accumulator);
+        for(size_t i = 0; i < 8; i++)
+        {
+            *dot += lanes[i];
+        }
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    if(count - done >= 4)
+    {
+        __m128 accumulator = _mm_setzero_ps();
+        for(; count - done >= 4; done += 4)
+        {
+            accumulator = _mm_add_ps(accumulator, _mm_mul_ps(_mm_loadu_ps(a + done), _mm_loadu_ps(b + done)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, accumulator);
+        *dot += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    if(count - done >= 4)
+    {
+        float32x4_t accumulator = vdupq_n_f32(0.0f);
+        for(; count - done >= 4; done += 4)
+        {
+            accumulator = vmlaq_f32(accumulator, vld1q_f32(a + done), vld1q_f32(b + done));
+        }
+        *dot += vaddvq_f32(accumulator);
+    }
+#else
+    (void)a; (void)b; (void)count; (void)dot;
+#endif
+    return done;
+}
+
+/**
+ * @brief Skip the bulk of the equal prefix of two buffers with the vector unit
+ * @return Number of leading bytes known to be equal (whole vectors only)
+ */
+static size_t compare_bytes_vector( const uint8_t* a, const uint8_t* b, size_t size )
+{
+    size_t done = 0;
+#if defined(DMDEVFS_KERNELS_AVX2)
+    for(; size - done >= 32; done += 32)
+    {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + done)),
+                                          _mm256_loadu_si256((const __m256i*)(b + done)));
+        if((uint32_t)_mm256_movemask_epi8(equal) != 0xFFFFFFFFu)
+        {
+            return done;
+        }
+    }
+#endif
+#if defined(DMDEVFS_KERNELS_SSSE3)
+    for(; size - done >= 16; done += 16)
+    {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + done)),
+                                       _mm_loadu_si128((const __m128i*)(b + done)));
+        if(_mm_movemask_epi8(equal) != 0xFFFF)
+        {
+            return done;
+        }
+    }
+#elif defined(DMDEVFS_KERNELS_NEON)
+    for(; size - done >= 16; done += 16)
+    {
+        uint8x16_t equal = vceqq_u8(vld1q_u8(a + done), vld1q_u8(b + done));
+        if(vminvq_u8(equal) != 0xFF)
+        {
+            return done;
+        }
+    }
+#else
+    (void)a; (void)b; (void)size;
+#endif
+    return done;
+}
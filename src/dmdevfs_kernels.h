@@ -0,0 +1,89 @@
+/**
+ * @file dmdevfs_kernels.h
+ * @brief DMOD Driver File System - Bulk data processing kernels
+ * @author Patryk Kubiak
+ *
+ * Kernels used by the per-handle processing stages. Each kernel has a portable
+ * implementation and, when the compiler targets it, an SSSE3, AVX2 or NEON one.
+ * The variant is selected at compile time from the predefined target macros.
+ */
+
+#ifndef DMDEVFS_KERNELS_H
+#define DMDEVFS_KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Sample formats supported by the conversion stage
+ */
+typedef enum
+{
+    DMDEVFS_SAMPLE_NONE = 0,    // No conversion
+    DMDEVFS_SAMPLE_S16LE,       // Signed 16-bit, little-endian
+    DMDEVFS_SAMPLE_S16BE,       // Signed 16-bit, big-endian
+    DMDEVFS_SAMPLE_S24LE,       // Signed 24-bit packed, little-endian
+    DMDEVFS_SAMPLE_S24BE,       // Signed 24-bit packed, big-endian
+    DMDEVFS_SAMPLE_S32LE,       // Signed 32-bit, little-endian
+    DMDEVFS_SAMPLE_S32BE,       // Signed 32-bit, big-endian
+    DMDEVFS_SAMPLE_S32,         // Native signed 32-bit integer
+    DMDEVFS_SAMPLE_F32,         // Native float, normalized to [-1.0, 1.0)
+} dmdevfs_sample_format_t;
+
+/**
+ * @brief Parse a sample format name (e.g. "s24be")
+ * @return Format or DMDEVFS_SAMPLE_NONE if the name is unknown
+ */
+dmdevfs_sample_format_t dmdevfs_parse_sample_format( const char* name );
+
+/**
+ * @brief Get the size of a single sample in bytes
+ */
+size_t dmdevfs_sample_size( dmdevfs_sample_format_t format );
+
+/**
+ * @brief Convert packed samples to a native format
+ * @param source_format Format of the input samples (any format)
+ * @param source Input samples
+ * @param target_format DMDEVFS_SAMPLE_S32 or DMDEVFS_SAMPLE_F32
+ * @param target Output buffer for @p count native samples (any alignment)
+ * @param count Number of samples to convert
+ */
+void dmdevfs_convert_samples( dmdevfs_sample_format_t source_format, const uint8_t* source,
+                              dmdevfs_sample_format_t target_format, void* target, size_t count );
+
+/**
+ * @brief Sum every @p stride -th sample, starting with the first one
+ */
+int64_t dmdevfs_sum_s32( const int32_t* samples, size_t count, size_t stride );
+
+/**
+ * @brief Sum every @p stride -th sample, starting with the first one
+ */
+double dmdevfs_sum_f32( const float* samples, size_t count, size_t stride );
+
+/**
+ * @brief Find the minimum or maximum of every @p stride -th sample
+ * @param initial Value returned when @p count is 0
+ */
+int32_t dmdevfs_extreme_s32( const int32_t* samples, size_t count, size_t stride, bool maximum, int32_t initial );
+
+/**
+ * @brief Find the minimum or maximum of every @p stride -th sample
+ * @param initial Value returned when @p count is 0
+ */
+float dmdevfs_extreme_f32( const float* samples, size_t count, size_t stride, bool maximum, float initial );
+
+/**
+ * @brief Compute the dot product of two contiguous vectors
+ */
+float dmdevfs_dot_f32( const float* a, const float* b, size_t count );
+
+/**
+ * @brief Find the first byte that differs between two buffers
+ * @return Offset of the first difference, @p size if the buffers are equal
+ */
+size_t dmdevfs_compare_bytes( const void* a, const void* b, size_t size );
+
+#endif // DMDEVFS_KERNELS_H
@@ -0,0 +1,126 @@
+/**
+ * @file dmdevfs_lz4.c
+ * @brief DMOD Driver File System - LZ4 block decoder
+ * @author Patryk Kubiak
+ *
+ * A block is a list of sequences: a token with the literal length (high
+ * nibble) and the match length minus 4 (low nibble), extra length bytes when
+ * a nibble is 15, the literals, and a 16-bit little-endian match offset. The
+ * last sequence has literals only.
+ */
+
+#include "dmdevfs_lz4.h"
+#include <string.h>
+
+/**
+ * @brief Shortest match encoded by a sequence
+ */
+#define LZ4_MIN_MATCH   4
+
+// ============================================================================
+//                      Local prototypes
+// ============================================================================
+static bool read_length( const uint8_t** input, const uint8_t* end, size_t* length );
+
+// ============================================================================
+//                      Public functions
+// ============================================================================
+
+/**
+ * @brief Decode an LZ4 block
+ */
+bool dmdevfs_lz4_decode( const void* source, size_t source_size, void* target, size_t target_size, size_t* decoded )
+{
+    const uint8_t* input = source;
+    const uint8_t* input_end = input + source_size;
+    uint8_t* output = target;
+    uint8_t* output_end = output + target_size;
+    *decoded = 0;
+
+    while(input < input_end)
+    {
+        uint8_t token = *input++;
+        size_t literals = token >> 4;
+        if(literals == 15 && !read_length(&input, input_end, &literals))
+        {
+            return false;
+        }
+        if(literals > (size_t)(input_end - input) || literals > (size_t)(output_end - output))
+        {
+            return false;
+        }
+        memcpy(output, input, literals);
+        input += literals;
+        output += literals;
+        if(input == input_end)
+        {
+            break;
+        }
+
+        if(input_end - input < 2)
+        {
+            return false;
+        }
+        size_t offset = (size_t)input[0] | ((size_t)input[1] << 8);
+        input += 2;
+        if(offset == 0 || offset > (size_t)(output - (uint8_t*)target))
+        {
+            return false;
+        }
+
+        size_t match = token & 0x0F;
+        if(match == 15 && !read_length(&input, input_end, &match))
+        {
+            return false;
+        }
+        match += LZ4_MIN_MATCH;
+        if(match > (size_t)(output_end - output))
+        {
+            return false;
+        }
+
+        const uint8_t* copy = output - offset;
+        if(offset >= match)
+        {
+            memcpy(output, copy, match);
+            output += match;
+        }
+        else
+        {
+            // Overlapping match repeats the last `offset` bytes
+            for(size_t i = 0; i < match; i++)
+            {
+                *output++ = copy[i];
+            }
+        }
+    }
+
+    *decoded = (size_t)(output - (uint8_t*)target);
+    return true;
+}
+
+// ============================================================================
+//                      Local functions
+// ============================================================================
+
+/**
+ * @brief Add the extra length bytes that follow a nibble of 15
+ */
+static bool read_length( const uint8_t** input, const uint8_t* end, size_t* length )
+{
+    uint8_t byte;
+    do
+    {
+        if(*input >= end)
+        {
+            return false;
+        }
+        byte = *(*input)++;
+        if(*length > SIZE_MAX - byte)
+        {
+            return false;
+        }
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file dmdevfs_lz4.h
+ * @brief DMOD Driver File System - LZ4 block decoder
+ * @author Patryk Kubiak
+ *
+ * Decoder of the LZ4 block format (the raw blocks of an LZ4 frame, as produced
+ * by LZ4_compress_default() or `lz4 -B`). Every length and match offset is
+ * checked against both buffers, so corrupted input is reported instead of
+ * reading or writing out of bounds.
+ */
+
+#ifndef DMDEVFS_LZ4_H
+#define DMDEVFS_LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Decode an LZ4 block
+ * @param source Compressed block
+ * @param source_size Size of the compressed block
+ * @param target Buffer for the decoded data
+ * @param target_size Size of the buffer
+ * @param decoded Number of bytes decoded
+ * @return true on success, false if the block is corrupted or does not fit into @p target
+ */
+bool dmdevfs_lz4_decode( const void* source, size_t source_size, void* target, size_t target_size, size_t* decoded );
+
+#endif // DMDEVFS_LZ4_H
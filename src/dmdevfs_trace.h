@@ -0,0 +1,35 @@
+/**
+ * @file dmdevfs_trace.h
+ * @brief DMOD Driver File System - Static tracepoints
+ * @author Patryk Kubiak
+ *
+ * Static probe points at every DMFSI entry and around every dmdrvi call.
+ * When DMDEVFS_ENABLE_TRACEPOINTS is defined on a Linux host with
+ * <sys/sdt.h> (systemtap-sdt-dev), the probes are USDT probes of the
+ * `dmdevfs` provider: each one is a single NOP in the code plus an ELF note,
+ * and tools like perf or bpftrace can attach to them at run time, e.g.:
+ *
+ *     bpftrace -e 'usdt:./dmdevfs.so:dmdevfs:dmdrvi_read_return { @[arg0] = hist(arg1); }'
+ *
+ * Otherwise the probes expand to nothing.
+ *
+ * Probes:
+ *  - `<function>` (e.g. `fopen`) - entry of dmfsi_dmdevfs_<function> or
+ *    dmdevfs_<function>, arguments as in the function
+ *  - `dmdrvi_<function>_entry` - before a dmdrvi call: node, size or command
+ *  - `dmdrvi_<function>_return` - after a dmdrvi call: node, result
+ *  - `slow_call` - a dmdrvi call took at least the `slow_call_ms` of the node:
+ *    node, DMDEVFS_OP_* of the call, duration in ms
+ */
+
+#ifndef DMDEVFS_TRACE_H
+#define DMDEVFS_TRACE_H
+
+#if defined(DMDEVFS_ENABLE_TRACEPOINTS) && defined(__linux__)
+#   include <sys/sdt.h>
+#   define DMDEVFS_TRACE(probe, ...)    STAP_PROBEV(dmdevfs, probe, __VA_ARGS__)
+#else
+#   define DMDEVFS_TRACE(probe, ...)    do { } while(0)
+#endif
+
+#endif // DMDEVFS_TRACE_H